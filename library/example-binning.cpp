@@ -0,0 +1,124 @@
+// This program checks the binnings of genhist-binning.h against
+// straightforward reference computations, times them, and uses an
+// EdgeBinning with logarithmic edges (as in tpacf) in a CPU histogram.
+
+#include "genhist-binning.h"
+#include "genhist-host.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <vector>
+
+#define INP_LEN     10000000
+
+struct DotCount : genhist::HistDescriptor<double, int32_t> {
+  inline static double key(double x) { return -x; }
+  inline static int32_t value(double) { return 1; }
+  inline static int32_t ne() { return 0; }
+  inline static int32_t opScal(int32_t a, int32_t b) { return a + b; }
+  inline static genhist::AtomicPrim atomicKind() { return genhist::HDW; }
+};
+
+long elapsedSince(struct timeval* t_start) {
+  struct timeval t_end;
+  gettimeofday(&t_end, NULL);
+  return (t_end.tv_sec - t_start->tv_sec) * 1000000 + (t_end.tv_usec - t_start->tv_usec);
+}
+
+template<class BIN, class REF>
+void check(const char* name, const BIN& bin, const std::vector<float>& xs, REF ref) {
+  std::vector<uint32_t> out(xs.size());
+  struct timeval t_start;
+  gettimeofday(&t_start, NULL);
+  bin.indices(xs.data(), xs.size(), out.data());
+  const long t_bin = elapsedSince(&t_start);
+
+  gettimeofday(&t_start, NULL);
+  int64_t mismatches = 0;
+  for (size_t i = 0; i < xs.size(); i++) {
+    if (!ref(xs[i], out[i])) {
+      if (mismatches++ == 0) {
+        printf("%s: INVALID RESULT for %.9g: %u\n", name, xs[i], out[i]);
+      }
+    }
+  }
+  const long t_ref = elapsedSince(&t_start);
+  if (mismatches > 0) {
+    exit(3);
+  }
+  printf("%s: %.2f ns per key (reference check %.2f ns)\n", name,
+         t_bin * 1000.0 / xs.size(), t_ref * 1000.0 / xs.size());
+}
+
+int main() {
+  srand(2006);
+  std::vector<float> xs(INP_LEN);
+  for (size_t i = 0; i < xs.size(); i++) {
+    xs[i] = (rand() / (float)RAND_MAX) * 1200.0f - 100.0f;
+  }
+
+  { // uniform: must agree with division except within rounding of an edge
+    const float lo = 0, hi = 1000;
+    const int H = 997;
+    genhist::UniformBinning<float> bin(lo, hi, H);
+    check("UniformBinning", bin, xs, [&](float x, uint32_t b) {
+        const double t = ((double)x - lo) / ((hi - lo) / (double)H);
+        const int r = std::min(H - 1, std::max(0, (int)floor(t)));
+        return (int)b == r || fabs(t - floor(t + 0.5)) < 1e-3;
+      });
+  }
+
+  { // log2: bin k covers [edge(k), edge(k+1))
+    genhist::Log2Binning<float> bin(0.5f, 12, 4);
+    check("Log2Binning", bin, xs, [&](float x, uint32_t b) {
+        const int H = bin.numBins();
+        if (x < bin.edge(1)) return b == 0;
+        if (x >= bin.edge(H - 1)) return (int)b == H - 1;
+        return bin.edge(b) <= x && x < bin.edge(b + 1);
+      });
+  }
+
+  { // explicit edges: must agree exactly with upper_bound
+    std::vector<float> edges = genhist::EdgeBinning<float>::logEdges(0.1f, 1000.0f, 5.0f);
+    genhist::EdgeBinning<float> bin(edges);
+    check("EdgeBinning", bin, xs, [&](float x, uint32_t b) {
+        return b == (uint32_t)(std::upper_bound(edges.begin(), edges.end(), x) - edges.begin());
+      });
+  }
+
+  { // tpacf-style histogram of dot products over descending edges
+    const double min_arcmin = 1.0, max_arcmin = 10000.0, bins_per_dec = 5.0;
+    std::vector<double> arcmin = genhist::EdgeBinning<double>::logEdges(min_arcmin, max_arcmin, bins_per_dec);
+    std::vector<double> edges;
+    for (size_t i = 0; i < arcmin.size(); i++) {
+      edges.push_back(-cos(arcmin[i] / 60.0 * M_PI / 180.0));
+    }
+    std::sort(edges.begin(), edges.end());
+
+    std::vector<double> dots(INP_LEN);
+    for (size_t i = 0; i < dots.size(); i++) {
+      dots[i] = cos((rand() / (double)RAND_MAX) * M_PI);
+    }
+
+    typedef genhist::BinnedHist<genhist::EdgeBinning<double>, DotCount> HP;
+    genhist::EdgeBinning<double> bin(edges);
+    HP desc(bin);
+    const int H = desc.bin.numBins();
+    genhist::HostGenHist<HP> hist(genhist::host_default, 1, H, dots.size(), desc);
+    hist.exec(dots.data());
+
+    std::vector<int32_t> ref(H, 0);
+    for (size_t i = 0; i < dots.size(); i++) {
+      ref[std::upper_bound(edges.begin(), edges.end(), -dots[i]) - edges.begin()]++;
+    }
+    for (int b = 0; b < H; b++) {
+      if (ref[b] != hist.result()[b]) {
+        printf("BinnedHist: INVALID RESULT, bin %d\n", b);
+        exit(3);
+      }
+    }
+    printf("BinnedHist with %d log-spaced bins: valid\n", H);
+  }
+  return 0;
+}
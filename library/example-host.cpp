@@ -0,0 +1,853 @@
+// This program uses the CPU generalized histogram library to compute
+// histograms for various histogram sizes and operators.  It validates
+// the result as compared to a sequential implementation.  It is the
+// host-side counterpart of example.cu.
+
+#include "genhist-host.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+#include <string.h>
+#include <iostream>
+#include <thread>
+
+#define HOST_RUNS   10
+
+#define INP_LEN     50000000
+#define Hmax        4000000
+
+#define RESET   "\033[0m"
+#define BOLD    "\033[1m"
+
+// Helpers
+
+int timeval_subtract(struct timeval *result, struct timeval *t2, struct timeval *t1)
+{
+  unsigned int resolution=1000000;
+  long int diff = (t2->tv_usec + resolution * t2->tv_sec) - (t1->tv_usec + resolution * t1->tv_sec);
+  result->tv_sec = diff / resolution;
+  result->tv_usec = diff % resolution;
+  return (diff<0);
+}
+
+void randomInit(int32_t* data, int size) {
+  for (int32_t i = 0; i < size; ++i)
+    data[i] = rand(); // (float)RAND_MAX;
+}
+
+template<class T>
+void zeroOut(typename T::BETA* data, int size) {
+  for (int i = 0; i < size; ++i)
+    data[i] = T::ne();
+}
+
+template<int num_histos>
+void printTextTab(const unsigned long runtimes[3][num_histos],
+                  const int64_t traffic[3][num_histos],
+                  const int histo_sizes[num_histos],
+                  const int RF) {
+  const double peak = genhist::systemBandwidth().peak();
+  for(int k=0; k<3; k++) {
+    printf("\n\n");
+
+    printf(BOLD "%s, RF=%d\n" RESET,
+           k == 0 ? "HDW" :
+           k == 1 ? "CAS" :
+           "XCG",
+           RF);
+
+    for(int i = 0; i<num_histos; i++) {
+      if (histo_sizes[i] > 1000) {
+        printf(BOLD "\tH=%dK" RESET, histo_sizes[i]/1000);
+      } else {
+        printf(BOLD "\tH=%d" RESET, histo_sizes[i]);
+      }
+    }
+
+    printf("\n" BOLD "Auto\t" RESET);
+    for(int i = 0; i<num_histos; i++) {
+      printf("%lu\t", runtimes[k][i]);
+    }
+    printf("\n" BOLD "GB/s\t" RESET);
+    for(int i = 0; i<num_histos; i++) {
+      printf("%.1f\t", traffic[k][i] / 1e3 / std::max(1UL, runtimes[k][i]));
+    }
+    printf("\n" BOLD "%%peak\t" RESET);
+    for(int i = 0; i<num_histos; i++) {
+      printf("%.0f%%\t", 100 * traffic[k][i] / 1e3 / std::max(1UL, runtimes[k][i]) / peak);
+    }
+    printf("\n");
+  }
+}
+
+// Histogram descriptors
+
+template<int RF>
+struct AddI32 : genhist::HistDescriptor<int32_t, int32_t> {
+  inline static
+  genhist::indval<BETA> f(const int32_t H, ALPHA pixel) {
+    genhist::indval<BETA> res;
+    const uint32_t ratio = std::max(1, H/RF);
+    const uint32_t contraction = (((uint32_t)pixel) % ratio);
+    res.index = contraction * RF;
+    res.value = pixel;
+    return res;
+  }
+
+  // 'f' for n elements at once, with the modulo strength-reduced (see
+  // genhist::FastDiv) so that the loop vectorizes.
+  inline static
+  void fBatch(const int32_t H, const ALPHA* xs, int n, uint32_t* idx, BETA* vals) {
+    const genhist::FastDiv ratio(std::max(1, H/RF));
+    for (int i = 0; i < n; i++) {
+      idx[i] = ratio.mod((uint32_t)xs[i]) * RF;
+      vals[i] = xs[i];
+    }
+  }
+
+  inline static
+  BETA ne() { return 0; }
+
+  inline static
+  BETA opScal(BETA v1, BETA v2) {
+    return (uint32_t)v1 + (uint32_t)v2;
+  }
+
+  inline static
+  genhist::AtomicPrim atomicKind() { return genhist::HDW; }
+
+  // 'opScal' is addition, so private subhistograms can be updated with
+  // SIMD scatters (see genhist-simd.h).
+  static const bool simd_add = true;
+};
+
+template<int RF>
+struct SatAdd24 : genhist::HistDescriptor<int32_t, uint32_t> {
+  inline static
+  genhist::indval<BETA> f(const int32_t H, ALPHA pixel) {
+    genhist::indval<BETA> res;
+    const uint32_t ratio = std::max(1, H/RF);
+    const uint32_t contraction = (((uint32_t)pixel) % ratio);
+    res.index = contraction * RF;
+    res.value = pixel % 4;
+    return res;
+  }
+
+  inline static
+  void fBatch(const int32_t H, const ALPHA* xs, int n, uint32_t* idx, BETA* vals) {
+    const genhist::FastDiv ratio(std::max(1, H/RF));
+    for (int i = 0; i < n; i++) {
+      idx[i] = ratio.mod((uint32_t)xs[i]) * RF;
+      vals[i] = xs[i] % 4;
+    }
+  }
+
+  inline static
+  BETA ne() { return 0; }
+
+  // 24-bits saturated addition
+  inline static
+  BETA opScal(BETA v1, BETA v2) {
+    const uint32_t SAT_VAL24 = (1 << 24) - 1;
+    uint32_t res;
+    if(SAT_VAL24 - v1 < v2) {
+      res = SAT_VAL24;
+    } else {
+      res = v1 + v2;
+    }
+    return res;
+  }
+
+  inline static
+  genhist::AtomicPrim atomicKind() { return genhist::CAS; }
+};
+
+// Maps about a tenth of the elements to indices at or above H, which
+// update no bin.
+struct OutOfRange : SatAdd24<1> {
+  inline static
+  genhist::indval<BETA> f(const int32_t H, ALPHA pixel) {
+    return SatAdd24<1>::f(H + H/10, pixel);
+  }
+
+  inline static
+  void fBatch(const int32_t H, const ALPHA* xs, int n, uint32_t* idx, BETA* vals) {
+    SatAdd24<1>::fBatch(H + H/10, xs, n, idx, vals);
+  }
+};
+
+template<int RF>
+struct ArgMaxI64 : genhist::HistDescriptor<int32_t, uint64_t> {
+  inline static
+  BETA pack64(uint32_t ind, uint32_t val) {
+    uint64_t res = ind;
+    uint64_t tmp = val;
+    tmp = tmp << 32;
+    res = res | tmp;
+    return res;
+  }
+
+  inline static
+  genhist::indval<uint32_t> unpack64(uint64_t t) {
+    const uint64_t MASK32bits = 4294967295;
+    genhist::indval<uint32_t> res;
+    res.index = (uint32_t) (t & MASK32bits);
+    res.value = (uint32_t) (t >> 32);
+    return res;
+  }
+
+  inline static
+  genhist::indval<BETA> f(const int32_t H, ALPHA pixel) {
+    genhist::indval<BETA> res;
+
+    const uint32_t ratio = std::max(1, H/RF);
+    const uint32_t contraction = (((uint32_t)pixel) % ratio);
+    res.index = contraction * RF;
+
+    res.value = pack64( (uint32_t)pixel/64, (uint32_t)pixel );
+    return res;
+  }
+
+  inline static
+  BETA ne() { return 0; }
+
+  inline static
+  BETA opScal(BETA v1, BETA v2) {
+    genhist::indval<uint32_t> arg1 = unpack64(v1);
+    genhist::indval<uint32_t> arg2 = unpack64(v2);
+    uint32_t ind, val;
+    if (arg1.value < arg2.value) {
+      ind = arg2.index; val = arg2.value;
+    } else if (arg1.value > arg2.value) {
+      ind = arg1.index; val = arg1.value;
+    } else { // arg1.value == arg2.value
+      ind = std::min(arg1.index, arg2.index);
+      val = arg1.value;
+    }
+    return pack64(ind, val);
+  }
+
+  inline static
+  genhist::AtomicPrim atomicKind() { return genhist::XCG; }
+};
+
+// Testing
+
+template<class T>
+void goldSeqHisto(const int32_t N, const int32_t H, typename T::ALPHA* input, typename T::BETA* histo) {
+  typedef typename T::BETA BETA;
+  zeroOut<T>(histo, H);
+  for(int32_t i=0; i<N; i++) {
+    struct genhist::indval<BETA> iv = T::f(H, input[i]);
+    if (iv.index < (uint32_t)H) {
+      histo[iv.index] = T::opScal(histo[iv.index], iv.value);
+    }
+  }
+}
+
+template<class HP>
+bool validate(const typename HP::BETA* A, const typename HP::BETA* B, unsigned int sizeAB) {
+  for(unsigned int i = 0; i < sizeAB; i++) {
+    if (A[i] != B[i]) {
+      std::cout << "INVALID RESULT, index: " << i << " val_A: " << A[i] << ", val_B: " << B[i] << std::endl;;
+      return false;
+    }
+  }
+  return true;
+}
+
+template<class HP>
+unsigned long
+hostHistoRunValid(const int32_t num_runs, const int32_t RF,
+                  const int32_t H, const int32_t N,
+                  typename HP::ALPHA* h_input,
+                  typename HP::BETA* h_ref_histo,
+                  int64_t* traffic) {
+  genhist::HostGenHist<HP> do_genhist(genhist::host_default, RF, H, N);
+
+  // dry run
+  do_genhist.exec(h_input);
+
+  unsigned long int elapsed;
+  struct timeval t_start, t_end, t_diff;
+  gettimeofday(&t_start, NULL);
+
+  // measure runtime
+  for(int32_t q=0; q<num_runs; q++) {
+    do_genhist.exec(h_input);
+  }
+
+  gettimeofday(&t_end, NULL);
+  timeval_subtract(&t_diff, &t_end, &t_start);
+  elapsed = (t_diff.tv_sec*1e6+t_diff.tv_usec);
+
+  if(!validate<HP>(do_genhist.result(), h_ref_histo, H)) {
+    printf("hostHistoRunValid: Validation FAILS!\n");
+    exit(3);
+  }
+  *traffic = do_genhist.trafficBytes();
+
+  return (elapsed/num_runs);
+}
+
+template<int RF>
+void runHostDataset(int32_t* h_input, uint32_t* h_histo, const int32_t N) {
+  const int num_histos = 10;
+  const int histo_sizes[num_histos] = {31, 127, 505, 2041, 6141, 12281, 24569, 49145, 196607, 1572863};
+  unsigned long runtimes[3][num_histos];
+  int64_t traffic[3][num_histos];
+
+  for(int i=0; i<num_histos; i++) {
+    const int H = histo_sizes[i];
+
+    { // FOR HDW
+      goldSeqHisto< AddI32<RF> >(N, H, h_input, (int32_t*)h_histo);
+      runtimes[0][i] = hostHistoRunValid< AddI32<RF> >( HOST_RUNS, RF, H, N, h_input, (int32_t*)h_histo, &traffic[0][i]);
+    }
+
+    { // FOR CAS
+      goldSeqHisto< SatAdd24<RF> >(N, H, h_input, h_histo);
+      runtimes[1][i] = hostHistoRunValid< SatAdd24<RF> >( HOST_RUNS, RF, H, N, h_input, h_histo, &traffic[1][i]);
+    }
+
+    { // FOR XCG
+      goldSeqHisto< ArgMaxI64<RF> >(N, H, h_input, (uint64_t*)h_histo);
+      runtimes[2][i] = hostHistoRunValid< ArgMaxI64<RF> >( HOST_RUNS, RF, H, N, h_input, (uint64_t*)h_histo, &traffic[2][i]);
+    }
+  }
+
+  printTextTab<num_histos>(runtimes, traffic, histo_sizes, RF);
+}
+
+// Computes the sum, minimum and maximum of the input in the same pass
+// as an AddI32 histogram, and validates them.
+void runSideReductions(int32_t* h_input, uint32_t* h_histo, const int32_t N) {
+  typedef genhist::Fused< genhist::SumReduce<int32_t, int64_t>,
+                          genhist::MinMaxReduce<int32_t> > SR;
+  const int H = 24569;
+  genhist::HostGenHist< AddI32<1> > do_genhist(genhist::host_default, 1, H, N);
+  SR::RES res = do_genhist.exec(h_input, SR());
+
+  int64_t sum = 0;
+  int32_t mn = h_input[0], mx = h_input[0];
+  for (int32_t i = 0; i < N; i++) {
+    sum += h_input[i];
+    mn = std::min(mn, h_input[i]);
+    mx = std::max(mx, h_input[i]);
+  }
+  goldSeqHisto< AddI32<1> >(N, H, h_input, (int32_t*)h_histo);
+  if (res.first != sum || res.second.first != mn || res.second.second != mx ||
+      !validate< AddI32<1> >(do_genhist.result(), (int32_t*)h_histo, H)) {
+    printf("runSideReductions: Validation FAILS!\n");
+    exit(4);
+  }
+  printf("\nFused side reductions: sum=%lld min=%d max=%d\n", (long long)sum, mn, mx);
+}
+
+// Computes a histogram over all D*D pairs of D input elements, as in
+// tpacf, by generating each pair from its index instead of storing the
+// pairs, and validates it against a materialised input.
+void runGenerate(int32_t* h_input, uint32_t* h_histo, const int32_t N) {
+  const int64_t D = std::min((int64_t)4096, (int64_t)sqrt((double)N));
+  const int64_t L = D * D;
+  const int H = 24569;
+  auto pair = [=](int64_t i) { return h_input[i / D] ^ h_input[i % D]; };
+
+  genhist::HostGenHist< AddI32<1> > do_genhist(genhist::host_default, 1, H, L);
+  struct timeval t_start, t_end, t_diff;
+  gettimeofday(&t_start, NULL);
+  do_genhist.execGenerate(L, pair);
+  gettimeofday(&t_end, NULL);
+  timeval_subtract(&t_diff, &t_end, &t_start);
+
+  int32_t* pairs = (int32_t*) malloc(sizeof(int32_t) * L);
+  for (int64_t i = 0; i < L; i++) {
+    pairs[i] = pair(i);
+  }
+  goldSeqHisto< AddI32<1> >(L, H, pairs, (int32_t*)h_histo);
+  free(pairs);
+  if (!validate< AddI32<1> >(do_genhist.result(), (int32_t*)h_histo, H)) {
+    printf("runGenerate: Validation FAILS!\n");
+    exit(5);
+  }
+  printf("Generated input of %lld pairs: %ld us\n", (long long)L,
+         (long)(t_diff.tv_sec*1000000 + t_diff.tv_usec));
+}
+
+// Computes a histogram of an input with long runs of equal elements,
+// as in images, which the library detects and pre-aggregates.
+void runRuns(int32_t* h_input, uint32_t* h_histo, const int32_t N) {
+  const int run = 16;
+  const int H = 505;
+  int32_t* runs = (int32_t*) malloc(sizeof(int32_t) * N);
+  for (int32_t i = 0; i < N; i++) {
+    runs[i] = h_input[i / run];
+  }
+
+  genhist::HostGenHist< SatAdd24<1> > do_genhist(genhist::host_default, 1, H, N);
+  unsigned long elapsed[2];
+  for (int k = 0; k < 2; k++) {
+    int32_t* input = k == 0 ? h_input : runs;
+    struct timeval t_start, t_end, t_diff;
+    gettimeofday(&t_start, NULL);
+    do_genhist.exec(input);
+    gettimeofday(&t_end, NULL);
+    timeval_subtract(&t_diff, &t_end, &t_start);
+    elapsed[k] = t_diff.tv_sec*1e6+t_diff.tv_usec;
+
+    goldSeqHisto< SatAdd24<1> >(N, H, input, h_histo);
+    if (!validate< SatAdd24<1> >(do_genhist.result(), h_histo, H) ||
+        do_genhist.preAggregated() != (k == 1)) {
+      printf("runRuns: Validation FAILS!\n");
+      exit(6);
+    }
+  }
+  free(runs);
+  printf("Runs of length %d: %lu us (random input: %lu us)\n", run, elapsed[1], elapsed[0]);
+}
+
+// Computes a large histogram under a memory budget that is smaller
+// than what the cost model would like to use, and validates it.
+void runBudget(int32_t* h_input, uint32_t* h_histo, const int32_t N) {
+  typedef AddI32<1> HP;
+  const int H = 196607;
+  const genhist::HostGenHistConfig unbounded = genhist::withThreads(genhist::host_default, 4);
+  const size_t wanted = genhist::HostGenHist<HP>::bytesRequired(unbounded, 1, H, N);
+  // room for at least the result and one (cache-line padded)
+  // subhistogram with its tile pass numbers
+  const size_t budget = std::max(wanted / 2, (2 * sizeof(HP::BETA) + 1) * H);
+  const genhist::HostGenHistConfig budgeted = genhist::withBudget(unbounded, budget);
+  genhist::HostGenHist<HP> do_genhist(budgeted, 1, H, N);
+  do_genhist.exec(h_input);
+
+  goldSeqHisto<HP>(N, H, h_input, (int32_t*)h_histo);
+  if (do_genhist.bytesAllocated() > budgeted.mem_budget ||
+      !validate<HP>(do_genhist.result(), (int32_t*)h_histo, H)) {
+    printf("runBudget: Validation FAILS!\n");
+    exit(7);
+  }
+  printf("Memory budget of %zu bytes: %d subhistograms, %zu bytes (unbounded: %zu bytes), %s, %zu bytes huge\n",
+         budgeted.mem_budget, do_genhist.numSubhistos(), do_genhist.bytesAllocated(), wanted,
+         genhist::pagePolicyName(do_genhist.pagePolicy()), do_genhist.hugeBytes());
+}
+
+// Computes a histogram with millions of bins, whose updates miss in
+// the cache, with and without the prefetching update loop.
+void runPrefetch(int32_t* h_input, uint32_t* h_histo, const int32_t N) {
+  typedef AddI32<1> HP;
+  const int H = 3999971;
+  unsigned long elapsed[2];
+  for (int k = 0; k < 2; k++) {
+    genhist::HostGenHist<HP> do_genhist(genhist::withPrefetch(genhist::host_default, k == 0 ? -1 : 16),
+                                        1, H, N);
+    struct timeval t_start, t_end, t_diff;
+    gettimeofday(&t_start, NULL);
+    do_genhist.exec(h_input);
+    gettimeofday(&t_end, NULL);
+    timeval_subtract(&t_diff, &t_end, &t_start);
+    elapsed[k] = t_diff.tv_sec*1e6+t_diff.tv_usec;
+
+    goldSeqHisto<HP>(N, H, h_input, (int32_t*)h_histo);
+    if (!validate<HP>(do_genhist.result(), (int32_t*)h_histo, H) ||
+        (N > genhist::HostGenHist<HP>::serial_max && do_genhist.prefetchDistance() != 16 * k)) {
+      printf("runPrefetch: Validation FAILS!\n");
+      exit(8);
+    }
+  }
+  printf("H=%d with prefetch distance 16: %lu us (without: %lu us, tuned distance: %d)\n",
+         H, elapsed[1], elapsed[0], genhist::tunedPrefetchDistance());
+}
+
+// Computes a small histogram, where threads of neighbouring
+// subhistograms may share cache lines, with each subhistogram layout,
+// validates it, and lets the library pick the fastest layout.
+void runLayouts(int32_t* h_input, uint32_t* h_histo, const int32_t N) {
+  typedef AddI32<1> HP;
+  const int H = 31;
+  const genhist::SubhistoLayout layouts[3] =
+    { genhist::BLOCKED, genhist::INTERLEAVED, genhist::PADDED };
+  goldSeqHisto<HP>(N, H, h_input, (int32_t*)h_histo);
+  printf("H=%d with %d subhistograms:", H,
+         genhist::HostGenHist<HP>(genhist::host_default, 1, H, N).numSubhistos());
+  for (int l = 0; l < 3; l++) {
+    genhist::HostGenHist<HP> do_genhist(genhist::withLayout(genhist::host_default, layouts[l]), 1, H, N);
+    struct timeval t_start, t_end, t_diff;
+    gettimeofday(&t_start, NULL);
+    do_genhist.exec(h_input);
+    gettimeofday(&t_end, NULL);
+    timeval_subtract(&t_diff, &t_end, &t_start);
+    if (!validate<HP>(do_genhist.result(), (int32_t*)h_histo, H)) {
+      printf("\nrunLayouts: Validation FAILS!\n");
+      exit(9);
+    }
+    printf(" %s %ld us,", genhist::subhistoLayoutName(layouts[l]),
+           (long)(t_diff.tv_sec*1000000 + t_diff.tv_usec));
+  }
+  const genhist::SubhistoLayout best =
+    genhist::HostGenHist<HP>::tuneLayout(genhist::host_default, 1, H, N, h_input);
+  printf(" tuned: %s\n", genhist::subhistoLayoutName(best));
+}
+
+// Prints the cache topology, and computes a histogram with cooperation
+// groups formed along it and without, and validates both.
+void runTopology(int32_t* h_input, uint32_t* h_histo, const int32_t N) {
+  typedef SatAdd24<1> HP;
+  const int H = 196607;
+  const genhist::CpuTopology& topo = genhist::CpuTopology::system();
+  printf("%d CPUs: %d per core, %d per L2 (%zu KiB), %d per LLC (%zu KiB);",
+         (int)topo.cpus.size(), topo.smt_threads, topo.l2_threads, topo.l2_bytes >> 10,
+         topo.llc_threads, topo.llc_bytes >> 10);
+  goldSeqHisto<HP>(N, H, h_input, h_histo);
+  for (int k = 0; k < 2; k++) {
+    genhist::HostGenHist<HP> do_genhist(genhist::withTopologyCoop(genhist::host_default, k == 1),
+                                        1, H, N);
+    do_genhist.exec(h_input);
+    if (!validate<HP>(do_genhist.result(), h_histo, H)) {
+      printf("\nrunTopology: Validation FAILS!\n");
+      exit(10);
+    }
+    printf(" C=%d %s", do_genhist.numCooperating(), k == 1 ? "by topology\n" : "by the cost model,");
+  }
+}
+
+// Computes small histograms with the scalar update loop and with each
+// SIMD kernel that this CPU supports, and validates them.
+void runSimd(int32_t* h_input, uint32_t* h_histo, const int32_t N) {
+  typedef AddI32<1> HP;
+  const int num_histos = 3;
+  const int histo_sizes[num_histos] = { 31, 505, 24569 };
+  for (int i = 0; i < num_histos; i++) {
+    const int H = histo_sizes[i];
+    goldSeqHisto<HP>(N, H, h_input, (int32_t*)h_histo);
+    printf("H=%d:", H);
+    for (int l = genhist::SIMD_SCALAR; l <= genhist::detectSimd(); l++) {
+      genhist::HostGenHist<HP> do_genhist(genhist::withSimd(genhist::host_default, (genhist::SimdLevel)l),
+                                          1, H, N);
+      do_genhist.exec(h_input); // warm up
+      struct timeval t_start, t_end, t_diff;
+      gettimeofday(&t_start, NULL);
+      do_genhist.exec(h_input);
+      gettimeofday(&t_end, NULL);
+      timeval_subtract(&t_diff, &t_end, &t_start);
+      if (!validate<HP>(do_genhist.result(), (int32_t*)h_histo, H)) {
+        printf("\nrunSimd: Validation FAILS!\n");
+        exit(11);
+      }
+      printf(" %s %ld us,", genhist::simdLevelName(do_genhist.simdLevel()),
+             (long)(t_diff.tv_sec*1000000 + t_diff.tv_usec));
+    }
+    printf("\n");
+  }
+}
+
+// Folds a large input into a histogram with millions of bins in small
+// blocks, each of which initialises only the subhistogram tiles that
+// it touches, and validates the result.
+void runLazyInit(int32_t* h_input, uint32_t* h_histo, const int32_t N) {
+  typedef AddI32<1> HP;
+  const int H = 3999971;
+  const int64_t block = 4 * genhist::HostGenHist<HP>::serial_max;
+  genhist::HostGenHist<HP> do_genhist(genhist::host_default, 1, H, N);
+  int64_t init_bins = 0;
+  int calls = 0;
+  struct timeval t_start, t_end, t_diff;
+  gettimeofday(&t_start, NULL);
+  for (int64_t i = 0; i < N; i += block) {
+    do_genhist.accumulate(h_input + i, std::min(block, N - i));
+    init_bins += do_genhist.initializedBins();
+    calls++;
+  }
+  gettimeofday(&t_end, NULL);
+  timeval_subtract(&t_diff, &t_end, &t_start);
+
+  goldSeqHisto<HP>(N, H, h_input, (int32_t*)h_histo);
+  if (!validate<HP>(do_genhist.result(), (int32_t*)h_histo, H)) {
+    printf("runLazyInit: Validation FAILS!\n");
+    exit(12);
+  }
+  printf("H=%d in %d blocks of %ld: %ld us, %ld of %ld subhistogram bins initialised per block\n",
+         H, calls, (long)block, (long)(t_diff.tv_sec*1000000 + t_diff.tv_usec),
+         (long)(init_bins / calls), (long)do_genhist.numSubhistos() * H);
+}
+
+// Folds the histogram of the input into an array that already holds
+// it, with execInto, and validates that every bin was combined and
+// that the engine's own result was left alone.
+void runInto(int32_t* h_input, uint32_t* h_histo, const int32_t N) {
+  typedef SatAdd24<1> HP;
+  const int H = 24569;
+  goldSeqHisto<HP>(N, H, h_input, h_histo);
+  std::vector<uint32_t> dest(h_histo, h_histo + H), empty(H, HP::ne());
+  genhist::HostGenHist<HP> do_genhist(genhist::host_default, 1, H, N);
+  do_genhist.execInto(dest.data(), h_input);
+  for (int i = 0; i < H; i++) {
+    h_histo[i] = HP::opScal(h_histo[i], h_histo[i]);
+  }
+  if (!validate<HP>(dest.data(), h_histo, H) ||
+      !validate<HP>(do_genhist.result(), empty.data(), H)) {
+    printf("runInto: Validation FAILS!\n");
+    exit(13);
+  }
+  printf("execInto an existing histogram: VALID\n");
+}
+
+// Profiles the updates of a contended histogram, validates the counts
+// against those of the sequential reference and a round trip through
+// the binary format, and estimates the race factor from them.
+void runProfile(int32_t* h_input, const int32_t N) {
+  typedef AddI32<63> HP;
+  const int H = 24569;
+  genhist::BinProfile profile;
+  genhist::HostGenHist<HP> do_genhist(genhist::host_default, 63, H, N);
+  do_genhist.setProfile(&profile);
+  do_genhist.exec(h_input);
+
+  char path[] = "/tmp/genhist-profileXXXXXX";
+  const int fd = mkstemp(path);
+  if (fd < 0) {
+    perror("mkstemp");
+    exit(14);
+  }
+  close(fd);
+  profile.writeBinary(path);
+  const genhist::BinProfile loaded = genhist::BinProfile::read(path);
+  unlink(path);
+
+  const genhist::BinProfile gold = genhist::BinProfile::ofInput(HP(), H, h_input, N);
+  if ((!do_genhist.preAggregated() && profile.updates != gold.updates) ||
+      loaded.updates != profile.updates || loaded.retries != profile.retries) {
+    printf("runProfile: Validation FAILS!\n");
+    exit(14);
+  }
+  printf("Profile of H=%d, RF=63: %llu updates, %llu retries, hottest bin %d, estimated RF %d\n",
+         H, (unsigned long long)profile.totalUpdates(), (unsigned long long)profile.totalRetries(),
+         profile.hottest(), profile.raceFactor());
+}
+
+// Traces two passes over the input, on the calling thread and every
+// worker, and writes them to 'path' for chrome://tracing or Perfetto.
+void runTrace(int32_t* h_input, uint32_t* h_histo, const int32_t N, const char* path) {
+  typedef AddI32<1> HP;
+  const int H = 24569;
+  genhist::Tracer tracer;
+  genhist::HostGenHist<HP> do_genhist(genhist::host_default, 1, H, N);
+  do_genhist.setTracer(&tracer);
+  do_genhist.exec(h_input);
+  do_genhist.accumulate(h_input, N);
+  do_genhist.setTracer(NULL);
+
+  int32_t* gold = (int32_t*)h_histo;
+  goldSeqHisto<HP>(N, H, h_input, gold);
+  for (int i = 0; i < H; i++) {
+    gold[i] = HP::opScal(gold[i], gold[i]);
+  }
+  if (!validate<HP>(do_genhist.result(), gold, H) || tracer.numEvents() < 2) {
+    printf("runTrace: Validation FAILS!\n");
+    exit(15);
+  }
+  tracer.writeJSON(path);
+  printf("Wrote %zu trace events to %s\n", tracer.numEvents(), path);
+}
+
+// Counts the hardware events of a histogram that fits in the L1 cache
+// and one that does not, per input element, if the counters are
+// permitted here.
+void runCounters(int32_t* h_input, uint32_t* h_histo, const int32_t N) {
+  typedef AddI32<1> HP;
+  const int Hs[] = { 31, 3999971 };
+  for (int k = 0; k < 2; k++) {
+    const int H = Hs[k];
+    genhist::HostGenHist<HP> do_genhist(genhist::host_default, 1, H, N);
+    if (!do_genhist.setCounters(true)) {
+      printf("Hardware counters unavailable: %s\n", do_genhist.countersError().c_str());
+      return;
+    }
+    do_genhist.exec(h_input);
+    goldSeqHisto<HP>(N, H, h_input, (int32_t*)h_histo);
+    if (!validate<HP>(do_genhist.result(), (int32_t*)h_histo, H)) {
+      printf("runCounters: Validation FAILS!\n");
+      exit(16);
+    }
+    const genhist::PerfSample& s = do_genhist.counters();
+    printf("Counters of H=%d, per element:", H);
+    for (int c = 0; c < genhist::PERF_NUM_COUNTERS; c++) {
+      const genhist::PerfCounter pc = (genhist::PerfCounter)c;
+      if (s[pc] >= 0) {
+        printf(" %s %.3f,", genhist::perfCounterName(pc), (double)s[pc] / N);
+      }
+    }
+    printf(" IPC %.2f\n", s.ipc());
+  }
+
+  // a pass run by another thread than the one that called setCounters
+  // counts that thread (the only one of a single-thread pool)
+  genhist::WorkerPool single(1);
+  genhist::HostGenHist<HP> do_genhist(genhist::host_default, 1, Hs[0], N, HP(), &single);
+  do_genhist.setCounters(true);
+  std::thread other([&] { do_genhist.exec(h_input); });
+  other.join();
+  bool counted = false;
+  for (int c = 0; c < genhist::PERF_NUM_COUNTERS; c++) {
+    counted = counted || do_genhist.counters()[(genhist::PerfCounter)c] > 0;
+  }
+  if (!counted) {
+    printf("runCounters: nothing counted for a pass on another thread!\n");
+    exit(16);
+  }
+}
+
+// Whether reading 'path' as a Futhark data file is rejected.
+bool rejectsDataFile(const char* path) {
+  try {
+    genhist::FutharkDataFile f(path);
+  } catch (const std::runtime_error&) {
+    return true;
+  }
+  return false;
+}
+
+// Computes histograms of inputs with indices at or above H, both short
+// enough to be processed sequentially and long enough to be split over
+// the threads, and validates that those elements were ignored.
+void runOutOfRange(int32_t* h_input, uint32_t* h_histo, const int32_t N) {
+  typedef OutOfRange HP;
+  const int H = 24569;
+  const int64_t serial_max = genhist::HostGenHist<HP>::serial_max;
+  const int32_t lengths[3] = { 1000, (int32_t)serial_max, (int32_t)std::min<int64_t>(N, 4 * serial_max) };
+  for (int k = 0; k < 3; k++) {
+    const int32_t n = std::min(N, lengths[k]);
+    goldSeqHisto<HP>(n, H, h_input, h_histo);
+    genhist::HostGenHist<HP> do_genhist(genhist::host_default, 1, H, n);
+    do_genhist.exec(h_input);
+    if (!validate<HP>(do_genhist.result(), h_histo, H)) {
+      printf("runOutOfRange: Validation FAILS!\n");
+      exit(18);
+    }
+  }
+  printf("Indices not below H, sequential and parallel: VALID\n");
+}
+
+// Round-trips values of several types and ranks through a Futhark
+// binary data file, and checks that malformed headers are rejected.
+void runDataFiles() {
+  char path[] = "/tmp/genhist-dataXXXXXX";
+  const int fd = mkstemp(path);
+  if (fd < 0) {
+    perror("mkstemp");
+    exit(17);
+  }
+  close(fd);
+
+  const int32_t ints[3] = { 1, -2, 3 };
+  const double scalar = 2.5;
+  const uint8_t bytes[6] = { 0, 1, 2, 253, 254, 255 };
+  const int64_t longs[4] = { INT64_MIN, -1, 0, INT64_MAX };
+  {
+    genhist::FutharkDataWriter out(path, 2);
+    out.write(ints, 3);
+    out.write(&scalar, std::vector<int64_t>());
+    out.write(bytes, std::vector<int64_t>{ 2, 3 });
+    out.write((const bool*)NULL, 0);
+    out.write(longs, std::vector<int64_t>{ 2, 2, 1 });
+    out.generate<float>(std::vector<int64_t>{ 1000 }, [](int64_t i) { return 0.5f * i; });
+  }
+  bool ok = true;
+  {
+    genhist::FutharkDataFile in(path);
+    ok = in.size() == 6 &&
+      in[0].copyOut<int32_t>() == std::vector<int32_t>(ints, ints + 3) &&
+      in[1].shape.empty() && in[1].copyOut<double>()[0] == scalar &&
+      in[2].shape == std::vector<int64_t>({ 2, 3 }) &&
+      in[2].copyOut<uint8_t>() == std::vector<uint8_t>(bytes, bytes + 6) &&
+      in[3].type == genhist::FUT_BOOL && in[3].numElems() == 0 &&
+      in[4].shape == std::vector<int64_t>({ 2, 2, 1 }) &&
+      in[4].copyOut<int64_t>() == std::vector<int64_t>(longs, longs + 4) &&
+      in[5].numElems() == 1000 && in[5].copyOut<float>()[999] == 499.5f;
+    try {
+      in[0].as<float>();
+      ok = false;
+    } catch (const std::invalid_argument&) { }
+  }
+
+  // a truncated header, a shape whose byte count overflows, one that
+  // exceeds the file, and a negative dimension
+  const int64_t shapes[4][2] = { { 4, -1 }, { (int64_t)1 << 62, 4 }, { 1000, 1 }, { -4, -4 } };
+  for (int k = 0; k < 4; k++) {
+    FILE* f = fopen(path, "wb");
+    fwrite("b\002\002 i32", 1, 7, f);
+    fwrite(shapes[k], sizeof(int64_t), k == 0 ? 1 : 2, f);
+    fwrite(ints, sizeof(int32_t), 3, f);
+    fclose(f);
+    ok = ok && rejectsDataFile(path);
+  }
+  try {
+    genhist::FutharkDataWriter out(path, 1);
+    out.write(ints, std::vector<int64_t>(256, 1));
+    ok = false;
+  } catch (const std::invalid_argument&) { }
+  unlink(path);
+
+  if (!ok) {
+    printf("runDataFiles: Validation FAILS!\n");
+    exit(17);
+  }
+  printf("Futhark data files: VALID\n");
+}
+
+void usage(const char *prog) {
+  fprintf(stderr, "Usage: %s [input length [trace file]]\n", prog);
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  if (argc > 3) {
+    usage(argv[0]);
+  }
+
+  const int32_t N = argc >= 2 ? atoi(argv[1]) : INP_LEN;
+  if (N <= 0) {
+    usage(argv[0]);
+  }
+
+  // set seed for rand()
+  srand(2006);
+
+  // 1. allocate host memory for input and histogram
+  int32_t* h_input = (int32_t*) malloc(sizeof(int32_t) * N);
+  uint64_t* h_histo = (uint64_t*) malloc(sizeof(uint64_t) * Hmax);
+
+  // 2. initialize host memory
+  randomInit(h_input, N);
+
+  const genhist::StreamBandwidth& bw = genhist::systemBandwidth();
+  printf("Memory bandwidth (STREAM, %d threads): copy %.1f, scale %.1f, add %.1f, triad %.1f GB/s\n",
+         genhist::WorkerPool::defaultPool().numThreads(), bw.copy, bw.scale, bw.add, bw.triad);
+
+  runHostDataset<1> (h_input, (uint32_t*)h_histo, N);
+  runHostDataset<63>(h_input, (uint32_t*)h_histo, N);
+  runSideReductions(h_input, (uint32_t*)h_histo, N);
+  runGenerate(h_input, (uint32_t*)h_histo, N);
+  runRuns(h_input, (uint32_t*)h_histo, N);
+  runBudget(h_input, (uint32_t*)h_histo, N);
+  runPrefetch(h_input, (uint32_t*)h_histo, N);
+  runLayouts(h_input, (uint32_t*)h_histo, N);
+  runTopology(h_input, (uint32_t*)h_histo, N);
+  runSimd(h_input, (uint32_t*)h_histo, N);
+  runLazyInit(h_input, (uint32_t*)h_histo, N);
+  runInto(h_input, (uint32_t*)h_histo, N);
+  runProfile(h_input, N);
+  runCounters(h_input, (uint32_t*)h_histo, N);
+  runDataFiles();
+  runOutOfRange(h_input, (uint32_t*)h_histo, N);
+  if (argc == 3) {
+    runTrace(h_input, (uint32_t*)h_histo, N, argv[2]);
+  }
+
+  // 3. clean up memory
+  free(h_input);
+  free(h_histo);
+}
@@ -0,0 +1,106 @@
+// This program reduces changing values by a fixed index array over
+// many steps, as a molecular dynamics code does with its neighbour
+// list.  It compares a HistPlan, built once, with HostGenHist, which
+// rediscovers the conflicts at every step, and validates both against
+// a sequential implementation.
+
+#include "genhist-plan.h"
+#include "genhist-host.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <vector>
+
+#define NUM_ELEMS   16000000
+#define HISTO_SIZE  100000
+#define NUM_STEPS   20
+
+struct AddI32 : genhist::HistDescriptor<int64_t, int32_t> {
+  const uint32_t* indices;
+  const int32_t* values;
+
+  AddI32(const uint32_t* indices = NULL, const int32_t* values = NULL)
+    : indices(indices), values(values) { }
+
+  // the input element is the position in 'indices' and 'values'
+  inline genhist::indval<BETA> f(const int32_t, ALPHA i) const {
+    genhist::indval<BETA> res;
+    res.index = indices[i];
+    res.value = values[i];
+    return res;
+  }
+
+  inline static
+  BETA ne() { return 0; }
+
+  inline static
+  BETA opScal(BETA v1, BETA v2) { return v1 + v2; }
+
+  inline static
+  genhist::AtomicPrim atomicKind() { return genhist::HDW; }
+};
+
+long usecsSince(const struct timeval& t_start) {
+  struct timeval t_end;
+  gettimeofday(&t_end, NULL);
+  return (t_end.tv_sec - t_start.tv_sec) * 1000000 + (t_end.tv_usec - t_start.tv_usec);
+}
+
+bool validate(const int32_t* A, const std::vector<int32_t>& ref, int step) {
+  for (size_t b = 0; b < ref.size(); b++) {
+    if (A[b] != ref[b]) {
+      printf("INVALID RESULT at step %d, bin %d: %d vs %d\n", step, (int)b, A[b], ref[b]);
+      return false;
+    }
+  }
+  return true;
+}
+
+int main() {
+  srand(2006);
+  std::vector<uint32_t> indices(NUM_ELEMS);
+  std::vector<int32_t> values(NUM_ELEMS);
+  for (int64_t i = 0; i < NUM_ELEMS; i++) {
+    // neighbour lists are clustered: mostly nearby bins
+    indices[i] = (i / (NUM_ELEMS / HISTO_SIZE) + rand() % 64) % HISTO_SIZE;
+  }
+
+  struct timeval t_start;
+  gettimeofday(&t_start, NULL);
+  genhist::HistPlan<AddI32> plan(HISTO_SIZE, indices.data(), NUM_ELEMS);
+  const long plan_us = usecsSince(t_start);
+
+  AddI32 desc(indices.data(), values.data());
+  genhist::HostGenHist<AddI32> genhist(genhist::host_default, 1, HISTO_SIZE, NUM_ELEMS, desc);
+  auto position = [](int64_t i) { return i; };
+
+  long plan_total = 0, genhist_total = 0;
+  std::vector<int32_t> ref(HISTO_SIZE);
+  for (int step = 0; step < NUM_STEPS; step++) {
+    for (int64_t i = 0; i < NUM_ELEMS; i++) {
+      values[i] = rand() % 1000;
+    }
+
+    gettimeofday(&t_start, NULL);
+    plan.exec(values.data());
+    plan_total += usecsSince(t_start);
+
+    gettimeofday(&t_start, NULL);
+    genhist.execGenerate(NUM_ELEMS, position);
+    genhist_total += usecsSince(t_start);
+
+    std::fill(ref.begin(), ref.end(), 0);
+    for (int64_t i = 0; i < NUM_ELEMS; i++) {
+      ref[indices[i]] += values[i];
+    }
+    if (!validate(plan.result(), ref, step) || !validate(genhist.result(), ref, step)) {
+      exit(3);
+    }
+  }
+
+  printf("Plan construction: %ld us (%ld segments)\n", plan_us, (long)plan.numSegments());
+  printf("HistPlan exec:     %ld us per step\n", plan_total / NUM_STEPS);
+  printf("HostGenHist exec:  %ld us per step\n", genhist_total / NUM_STEPS);
+  return 0;
+}
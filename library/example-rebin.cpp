@@ -0,0 +1,104 @@
+// This program computes single-pass histograms of real-valued data
+// with genhist-rebin.h, starting from deliberately wrong range
+// estimates, and validates them against a two-pass computation over
+// the final grid.
+
+#include "genhist-rebin.h"
+
+#include <float.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <limits>
+#include <vector>
+
+#define INP_LEN     20000000
+#define HISTO_SIZE  1024
+
+struct CountF32 : genhist::RealHistDescriptor<float, int32_t> {
+  inline static double key(float x) { return x; }
+  inline static int32_t value(float) { return 1; }
+  inline static int32_t ne() { return 0; }
+  inline static int32_t opScal(int32_t a, int32_t b) { return a + b; }
+};
+
+struct MaxF32 : genhist::RealHistDescriptor<float, float> {
+  inline static double key(float x) { return x; }
+  inline static float value(float x) { return x * x; }
+  inline static float ne() { return 0; }
+  inline static float opScal(float a, float b) { return std::max(a, b); }
+};
+
+// Bins are numbered from the origin of the grid (the estimated 'lo'),
+// as the library does: measuring keys from hist.lo() instead rounds
+// keys within an ulp of the origin into the wrong bin once bins are
+// wide.
+template<class RP>
+bool twoPassValid(const genhist::AdaptiveGenHist<RP>& hist, const std::vector<float>& input,
+                  double origin) {
+  typedef typename RP::BETA BETA;
+  std::vector<BETA> ref(HISTO_SIZE, RP::ne());
+  const int64_t j0 = llround((hist.lo() - origin) / hist.binWidth());
+  for (size_t i = 0; i < input.size(); i++) {
+    const int64_t j = (int64_t)floor((RP::key(input[i]) - origin) / hist.binWidth()) - j0;
+    if (j < 0 || j >= HISTO_SIZE) {
+      printf("INVALID RESULT: key %f outside final grid\n", RP::key(input[i]));
+      return false;
+    }
+    ref[j] = RP::opScal(ref[j], RP::value(input[i]));
+  }
+  for (int b = 0; b < HISTO_SIZE; b++) {
+    if (ref[b] != hist.result()[b]) {
+      printf("INVALID RESULT, bin %d\n", b);
+      return false;
+    }
+  }
+  return true;
+}
+
+template<class RP>
+void run(const char* name, const std::vector<float>& input, double lo, double hi) {
+  struct timeval t_start, t_end;
+  gettimeofday(&t_start, NULL);
+  genhist::AdaptiveGenHist<RP> hist =
+    genhist::adaptiveHisto<RP>(input.data(), input.size(), HISTO_SIZE, lo, hi);
+  gettimeofday(&t_end, NULL);
+  const long elapsed = (t_end.tv_sec - t_start.tv_sec) * 1000000 + (t_end.tv_usec - t_start.tv_usec);
+
+  if (!twoPassValid(hist, input, lo)) {
+    exit(3);
+  }
+  printf("%s, estimate [%g,%g): final [%g,%g), %d rebins, %ld us\n",
+         name, lo, hi, hist.lo(), hist.hi(), hist.numRebins(), elapsed);
+}
+
+int main() {
+  srand(2006);
+  std::vector<float> input(INP_LEN);
+  for (size_t i = 0; i < input.size(); i++) {
+    // roughly normal, mean 3, with a long tail
+    float x = 0;
+    for (int k = 0; k < 4; k++) {
+      x += rand() / (float)RAND_MAX;
+    }
+    input[i] = 3 + (x - 2) * ((i % 1000 == 0) ? 1000 : 1);
+  }
+
+  run<CountF32>("CountF32", input, 2.0, 4.0);
+  run<CountF32>("CountF32", input, -2000.0, 2000.0);
+  run<MaxF32>("MaxF32", input, 100.0, 100.5);
+
+  // the extremes of float, among ordinary keys
+  const float extremes[] = { 0.5f, FLT_MAX, -FLT_MAX, 3, FLT_MIN, -FLT_MIN, std::numeric_limits<float>::denorm_min(),
+                             1e30f, -1e-30f, nextafterf(FLT_MAX, 0), 0.999f };
+  std::vector<float> extreme(input.begin(), input.begin() + 100000);
+  for (size_t i = 0; i < extreme.size(); i += 997) {
+    extreme[i] = extremes[(i / 997) % (sizeof(extremes) / sizeof(extremes[0]))];
+  }
+  run<CountF32>("CountF32, extreme keys", extreme, 0.0, 1.0);
+  run<CountF32>("CountF32, extreme keys", std::vector<float>(extremes, extremes + 4), 0.0, 1.0);
+  run<MaxF32>("MaxF32, extreme keys", extreme, -1e-3, 1e-3);
+  // a window so narrow that the keys span more than DBL_MAX of its width
+  run<CountF32>("CountF32, extreme keys", extreme, 0.0, 1e-300);
+  return 0;
+}
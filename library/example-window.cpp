@@ -0,0 +1,156 @@
+// This program maintains sliding-window histograms with
+// genhist-window.h, for an invertible operator (addition) and a
+// non-invertible one (maximum), and validates them against histograms
+// recomputed from scratch over the current window.
+
+#include "genhist-window.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <stdexcept>
+#include <vector>
+
+#define STREAM_LEN  20000000
+#define WINDOW      1000000
+#define HISTO_SIZE  4093
+#define MAX_BATCH   4096
+#define CHECK_EVERY 500
+
+struct AddI32 : genhist::HistDescriptor<int32_t, int32_t> {
+  inline static
+  genhist::indval<BETA> f(const int32_t H, ALPHA pixel) {
+    genhist::indval<BETA> res;
+    res.index = ((uint32_t)pixel) % H;
+    res.value = pixel & 0xffff;
+    return res;
+  }
+
+  inline static
+  BETA ne() { return 0; }
+
+  inline static
+  BETA opScal(BETA v1, BETA v2) { return v1 + v2; }
+
+  inline static
+  BETA opInv(BETA v) { return -v; }
+
+  inline static
+  genhist::AtomicPrim atomicKind() { return genhist::HDW; }
+};
+
+struct MaxU32 : genhist::HistDescriptor<int32_t, uint32_t> {
+  inline static
+  genhist::indval<BETA> f(const int32_t H, ALPHA pixel) {
+    genhist::indval<BETA> res;
+    res.index = ((uint32_t)pixel) % H;
+    res.value = ((uint32_t)pixel) >> 8;
+    return res;
+  }
+
+  inline static
+  BETA ne() { return 0; }
+
+  inline static
+  BETA opScal(BETA v1, BETA v2) { return std::max(v1, v2); }
+
+  inline static
+  genhist::AtomicPrim atomicKind() { return genhist::CAS; }
+};
+
+// HP with a tenth of its indices beyond H, which the window must
+// ignore.
+template<class HP>
+struct OutOfRange : HP {
+  inline static
+  genhist::indval<typename HP::BETA> f(const int32_t H, typename HP::ALPHA pixel) {
+    return HP::f(H + H/10, pixel);
+  }
+};
+
+template<class HP>
+bool checkWindow(const genhist::WindowGenHist<HP>& win, const std::vector<int32_t>& input,
+                 int64_t end, int H) {
+  typedef typename HP::BETA BETA;
+  std::vector<BETA> ref(H, HP::ne());
+  for (int64_t i = std::max((int64_t)0, end - WINDOW); i < end; i++) {
+    genhist::indval<BETA> iv = HP::f(H, input[i]);
+    if (iv.index < (uint32_t)H) {
+      ref[iv.index] = HP::opScal(ref[iv.index], iv.value);
+    }
+  }
+  for (int b = 0; b < H; b++) {
+    if (ref[b] != win.result()[b]) {
+      printf("INVALID RESULT after %ld elements, bin %d: %ld vs %ld\n",
+             (long)end, b, (long)win.result()[b], (long)ref[b]);
+      return false;
+    }
+  }
+  return true;
+}
+
+template<class HP>
+void runWindow(const char* name, const std::vector<int32_t>& input) {
+  genhist::WindowGenHist<HP> win(HISTO_SIZE, WINDOW);
+  srand(17);
+  struct timeval t_start, t_end;
+  unsigned long elapsed = 0;
+  int64_t pos = 0;
+  for (int batch = 0; pos < (int64_t)input.size(); batch++) {
+    const int64_t n = std::min((int64_t)(1 + rand() % MAX_BATCH), (int64_t)input.size() - pos);
+    gettimeofday(&t_start, NULL);
+    win.push(&input[pos], n);
+    gettimeofday(&t_end, NULL);
+    elapsed += (t_end.tv_sec - t_start.tv_sec) * 1000000 + (t_end.tv_usec - t_start.tv_usec);
+    pos += n;
+    if (batch % CHECK_EVERY == 0 && !checkWindow(win, input, pos, HISTO_SIZE)) {
+      exit(3);
+    }
+  }
+  if (!checkWindow(win, input, pos, HISTO_SIZE)) {
+    exit(3);
+  }
+  printf("%s (%s): %.2f ns per element\n", name,
+         genhist::WindowGenHist<HP>::invertible ? "inverse" : "two-stack",
+         elapsed * 1000.0 / input.size());
+}
+
+// Whether 'push' throws std::logic_error.
+template<class F>
+bool rejects(F push) {
+  try {
+    push();
+  } catch (const std::logic_error&) {
+    return true;
+  }
+  return false;
+}
+
+// Mixing pushes with and without timestamps must be rejected either
+// way round, as expire() needs a timestamp for every element.
+void runMixedPushes(const std::vector<int32_t>& input) {
+  const int64_t ts[2] = { 1, 2 };
+  genhist::WindowGenHist<AddI32> timed(HISTO_SIZE, WINDOW), untimed(HISTO_SIZE, WINDOW);
+  timed.push(&input[0], 2, ts);
+  untimed.push(&input[0], 2);
+  if (!rejects([&] { timed.push(&input[2], 2); }) ||
+      !rejects([&] { untimed.push(&input[2], 2, ts); })) {
+    printf("Mixing timestamped and untimestamped pushes is not rejected!\n");
+    exit(3);
+  }
+}
+
+int main() {
+  srand(2006);
+  std::vector<int32_t> input(STREAM_LEN);
+  for (size_t i = 0; i < input.size(); i++) {
+    input[i] = rand();
+  }
+  runWindow<AddI32>("AddI32", input);
+  runWindow<MaxU32>("MaxU32", input);
+  runMixedPushes(input);
+  input.resize(STREAM_LEN / 10);
+  runWindow< OutOfRange<AddI32> >("AddI32, indices beyond H", input);
+  runWindow< OutOfRange<MaxU32> >("MaxU32, indices beyond H", input);
+  return 0;
+}
@@ -434,13 +434,76 @@ void runGlobalMemDataset(int* h_input, uint32_t* h_histo, int* d_input, const in
   printTextTab<num_histos,num_m_degs>(runtimes, histo_sizes, subhisto_degs, RF);
 }
 
+// Computes histograms that span several chunks with the input
+// partitioned by chunk once, instead of re-read for every chunk, and
+// validates them.
+void runPartitioned(int32_t* h_input, uint32_t* h_histo, int32_t* d_input, const int32_t N) {
+  typedef AddI32<1> HP;
+  const genhist::GenHistConfig consts{ 0.75, 0.4, 4096*1024, 16, 12, 2, 0, 0, 2, genhist::run_length_min };
+  const int H_loc = 49145, H_glb = 1572863;
+  goldSeqHisto<HP>(N, H_glb, h_input, (int32_t*)h_histo);
+  genhist::GlobalMemoryGenHist<HP> glb(consts, 256, 1, H_glb, N);
+  glb.exec(d_input);
+  cudaDeviceSynchronize();
+  gpuAssert( cudaPeekAtLastError() );
+  std::vector<int32_t> res(H_glb);
+  cudaMemcpy(res.data(), glb.result(), H_glb * sizeof(int32_t), cudaMemcpyDeviceToHost);
+  bool is_valid = validate<HP>(res.data(), (int32_t*)h_histo, H_glb);
+
+  goldSeqHisto<HP>(N, H_loc, h_input, (int32_t*)h_histo);
+  genhist::LocalMemoryGenHist<HP> loc(consts, H_loc, N);
+  loc.exec(d_input);
+  cudaDeviceSynchronize();
+  gpuAssert( cudaPeekAtLastError() );
+  cudaMemcpy(res.data(), loc.result(), H_loc * sizeof(int32_t), cudaMemcpyDeviceToHost);
+  is_valid = is_valid && validate<HP>(res.data(), (int32_t*)h_histo, H_loc);
+
+  if (!is_valid) {
+    printf("runPartitioned: Validation FAILS!\n");
+    exit(7);
+  }
+  // both histograms span several chunks, from partition_min_chunks = 2
+  if (!loc.partitioned() || !glb.partitioned()) {
+    printf("runPartitioned: input not partitioned (local %s, global %s)!\n",
+           loc.partitioned() ? "yes" : "no", glb.partitioned() ? "yes" : "no");
+    exit(9);
+  }
+  printf("Partitioned by chunk: VALID\n");
+}
+
+// Folds the histogram of the input into a device array that already
+// holds it, with execInto, and validates that every bin was combined.
+template<class GH>
+void runInto(GH& do_genhist, const char* name, int32_t* h_input, int32_t* d_input,
+             const int32_t N, const int32_t H) {
+  typedef AddI32<1> HP;
+  std::vector<int32_t> gold(H), res(H);
+  goldSeqHisto<HP>(N, H, h_input, gold.data());
+  int32_t* d_dest;
+  cudaMalloc((void**) &d_dest, H * sizeof(int32_t));
+  cudaMemcpy(d_dest, gold.data(), H * sizeof(int32_t), cudaMemcpyHostToDevice);
+  do_genhist.execInto(d_dest, d_input);
+  cudaDeviceSynchronize();
+  gpuAssert( cudaPeekAtLastError() );
+  cudaMemcpy(res.data(), d_dest, H * sizeof(int32_t), cudaMemcpyDeviceToHost);
+  cudaFree(d_dest);
+  for (int i = 0; i < H; i++) {
+    gold[i] = HP::opScal(gold[i], gold[i]);
+  }
+  if (!validate<HP>(res.data(), gold.data(), H)) {
+    printf("runInto: Validation FAILS!\n");
+    exit(8);
+  }
+  printf("execInto an existing histogram (%s memory): VALID\n", name);
+}
+
 void usage(const char *prog) {
-  fprintf(stderr, "Usage: %s <local|global>\n", prog);
+  fprintf(stderr, "Usage: %s <local|global> [trace file]\n", prog);
   exit(1);
 }
 
 int main(int argc, char **argv) {
-  if (argc != 2 && argc != 8) {
+  if (argc != 2 && argc != 3) {
     usage(argv[0]);
   }
 
@@ -471,13 +534,26 @@ int main(int argc, char **argv) {
   cudaMalloc((void**) &d_input, mem_size_input);
   cudaMemcpy(d_input, h_input, mem_size_input, cudaMemcpyHostToDevice);
 
+  genhist::Tracer tracer;
   if (run_local) {
     runLocalMemDataset<1> (h_input, h_histo, d_input, INP_LEN);
     runLocalMemDataset<63>(h_input, h_histo, d_input, INP_LEN);
+    runPartitioned(h_input, h_histo, d_input, INP_LEN);
+    genhist::LocalMemoryGenHist<AddI32<1> > loc(genhist::rtx2080, 12281, INP_LEN);
+    loc.setTracer(argc == 3 ? &tracer : NULL);
+    runInto(loc, "local", h_input, d_input, INP_LEN, 12281);
   } else {
     runGlobalMemDataset<1> (h_input, h_histo, d_input, INP_LEN);
     runGlobalMemDataset<63>(h_input, h_histo, d_input, INP_LEN);
+    genhist::GlobalMemoryGenHist<AddI32<1> > glb(genhist::rtx2080, 256, 1, 196607, INP_LEN);
+    glb.setTracer(argc == 3 ? &tracer : NULL);
+    runInto(glb, "global", h_input, d_input, INP_LEN, 196607);
+  }
 
+  // the phases of the execInto run, for chrome://tracing or Perfetto
+  if (argc == 3) {
+    tracer.writeJSON(argv[2]);
+    printf("Wrote %zu trace events to %s\n", tracer.numEvents(), argv[2]);
   }
 
   // 7. clean up memory
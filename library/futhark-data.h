@@ -0,0 +1,358 @@
+// Reader and writer for Futhark's binary data format, as produced by
+// 'futhark dataset -b' and consumed by 'futhark bench'.
+//
+// A binary value is laid out as
+//
+//   'b' <version:u8=2> <rank:u8> <type:4 bytes> <shape:rank*i64> <data>
+//
+// where the type is one of "  i8", " i16", " i32", " i64", "  u8",
+// " u16", " u32", " u64", " f16", " f32", " f64", or "bool", and all
+// numbers are little-endian.  A file may contain several such values
+// one after another, optionally separated by whitespace.
+//
+// FutharkDataFile maps a whole file read-only and validates every
+// header; the values then point directly into the mapping, so no
+// element is copied.  Note that the header is 7+8*rank bytes long, so
+// array data is in general *not* naturally aligned.  This is harmless
+// on x86, but use copyOut() on strict-alignment targets.
+//
+// FutharkDataWriter appends values to a file, with the payload of each
+// array written (or generated) by several threads in parallel using
+// positional writes.
+
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace genhist {
+
+enum FutharkType {FUT_I8, FUT_I16, FUT_I32, FUT_I64,
+                  FUT_U8, FUT_U16, FUT_U32, FUT_U64,
+                  FUT_F16, FUT_F32, FUT_F64, FUT_BOOL};
+
+static const char* const futhark_type_names[] =
+  { "  i8", " i16", " i32", " i64",
+    "  u8", " u16", " u32", " u64",
+    " f16", " f32", " f64", "bool" };
+
+static const int futhark_type_sizes[] =
+  { 1, 2, 4, 8,
+    1, 2, 4, 8,
+    2, 4, 8, 1 };
+
+// Maps a C++ element type to its Futhark type.
+template<class T> struct FutharkPrim;
+template<> struct FutharkPrim<int8_t>   { static const FutharkType type = FUT_I8; };
+template<> struct FutharkPrim<int16_t>  { static const FutharkType type = FUT_I16; };
+template<> struct FutharkPrim<int32_t>  { static const FutharkType type = FUT_I32; };
+template<> struct FutharkPrim<int64_t>  { static const FutharkType type = FUT_I64; };
+template<> struct FutharkPrim<uint8_t>  { static const FutharkType type = FUT_U8; };
+template<> struct FutharkPrim<uint16_t> { static const FutharkType type = FUT_U16; };
+template<> struct FutharkPrim<uint32_t> { static const FutharkType type = FUT_U32; };
+template<> struct FutharkPrim<uint64_t> { static const FutharkType type = FUT_U64; };
+template<> struct FutharkPrim<float>    { static const FutharkType type = FUT_F32; };
+template<> struct FutharkPrim<double>   { static const FutharkType type = FUT_F64; };
+template<> struct FutharkPrim<bool>     { static const FutharkType type = FUT_BOOL; };
+
+struct FutharkValue
+{
+  FutharkType type;
+  std::vector<int64_t> shape; // empty for scalars
+  const char* data;           // points into the file mapping
+  int64_t offset;             // byte offset of 'data' within the file
+
+  int64_t numElems() const {
+    int64_t n = 1;
+    for (size_t i = 0; i < shape.size(); i++) {
+      n *= shape[i];
+    }
+    return n;
+  }
+
+  int64_t numBytes() const {
+    return numElems() * futhark_type_sizes[type];
+  }
+
+  // Zero-copy view of the elements; throws if T does not match.
+  template<class T>
+  const T* as() const {
+    if (FutharkPrim<T>::type != type) {
+      throw std::invalid_argument(std::string("value has type ") + futhark_type_names[type]);
+    }
+    return (const T*) data;
+  }
+
+  template<class T>
+  std::vector<T> copyOut() const {
+    const T* p = as<T>();
+    std::vector<T> res(numElems());
+    memcpy(res.data(), p, numBytes());
+    return res;
+  }
+};
+
+// Parses the value header at 'p' (with 'len' bytes available).  On
+// success fills in everything but 'data'/'offset' and returns the
+// header length; throws std::runtime_error on malformed input,
+// including shapes whose payload would not fit in the 'len' bytes (so
+// numElems and numBytes cannot overflow for an accepted value).
+inline size_t
+parseFutharkHeader(const char* p, size_t len, FutharkValue* v) {
+  if (len < 7) {
+    throw std::runtime_error("truncated Futhark value header");
+  }
+  if (p[0] != 'b') {
+    throw std::runtime_error("not a binary Futhark value (text format is not supported)");
+  }
+  if (p[1] != 2) {
+    throw std::runtime_error("unsupported Futhark binary format version " + std::to_string((int)p[1]));
+  }
+  const int rank = (uint8_t)p[2];
+  int t = 0;
+  while (t <= FUT_BOOL && memcmp(p+3, futhark_type_names[t], 4) != 0) {
+    t++;
+  }
+  if (t > FUT_BOOL) {
+    throw std::runtime_error("unknown Futhark type '" + std::string(p+3, 4) + "'");
+  }
+  const size_t hdr_len = 7 + 8 * (size_t)rank;
+  if (len < hdr_len) {
+    throw std::runtime_error("truncated Futhark value header");
+  }
+  v->type = (FutharkType)t;
+  v->shape.resize(rank);
+  // the payload bytes left after the header, as an element count
+  const int64_t avail = (int64_t)std::min(len - hdr_len, (size_t)INT64_MAX) / futhark_type_sizes[t];
+  int64_t n = 1;
+  for (int i = 0; i < rank; i++) {
+    memcpy(&v->shape[i], p + 7 + 8*i, sizeof(int64_t));
+    if (v->shape[i] < 0) {
+      throw std::runtime_error("negative dimension in Futhark value");
+    }
+    // n stays at most 'avail', so the product cannot overflow
+    if (v->shape[i] > 0 && n > avail / v->shape[i]) {
+      throw std::runtime_error("Futhark value shape exceeds the file");
+    }
+    n *= v->shape[i];
+  }
+  return hdr_len;
+}
+
+class FutharkDataFile
+{
+public:
+  FutharkDataFile(const char* path) : map(NULL), map_len(0) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+      throw std::runtime_error(std::string("cannot open ") + path + ": " + strerror(errno));
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+      close(fd);
+      throw std::runtime_error(std::string("cannot stat ") + path);
+    }
+    map_len = st.st_size;
+    if (map_len > 0) {
+      map = (char*) mmap(NULL, map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) {
+      throw std::runtime_error(std::string("cannot map ") + path + ": " + strerror(errno));
+    }
+
+    try {
+      size_t pos = 0;
+      for (;;) {
+        while (pos < map_len && isspace((unsigned char)map[pos])) {
+          pos++;
+        }
+        if (pos == map_len) {
+          break;
+        }
+        FutharkValue v;
+        pos += parseFutharkHeader(map + pos, map_len - pos, &v);
+        if ((int64_t)(map_len - pos) < v.numBytes()) {
+          throw std::runtime_error("truncated Futhark value payload");
+        }
+        v.data = map + pos;
+        v.offset = pos;
+        pos += v.numBytes();
+        vals.push_back(v);
+      }
+    } catch (const std::runtime_error& e) {
+      munmap(map, map_len);
+      throw std::runtime_error(std::string(path) + ": " + e.what());
+    }
+    if (map_len > 0) {
+      madvise(map, map_len, MADV_SEQUENTIAL);
+    }
+  }
+
+  ~FutharkDataFile() {
+    if (map_len > 0) {
+      munmap(map, map_len);
+    }
+  }
+
+  FutharkDataFile(const FutharkDataFile&) = delete;
+  FutharkDataFile& operator=(const FutharkDataFile&) = delete;
+
+  size_t size() const { return vals.size(); }
+  const FutharkValue& operator[](size_t i) const { return vals.at(i); }
+  const std::vector<FutharkValue>& values() const { return vals; }
+
+private:
+  char* map;
+  size_t map_len;
+  std::vector<FutharkValue> vals;
+};
+
+class FutharkDataWriter
+{
+public:
+  // Truncates 'path'.  'num_threads' of zero means one thread per core.
+  FutharkDataWriter(const char* path, int num_threads = 0) : pos(0) {
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+      throw std::runtime_error(std::string("cannot open ") + path + ": " + strerror(errno));
+    }
+    T = num_threads > 0 ? num_threads :
+      std::max(1, (int)std::thread::hardware_concurrency());
+  }
+
+  ~FutharkDataWriter() {
+    close(fd);
+  }
+
+  FutharkDataWriter(const FutharkDataWriter&) = delete;
+  FutharkDataWriter& operator=(const FutharkDataWriter&) = delete;
+
+  // Append an array (or a scalar, with an empty shape).  Throws
+  // std::invalid_argument for a rank above 255, a negative dimension,
+  // or a payload of more than INT64_MAX bytes.
+  template<class E>
+  void write(const E* data, const std::vector<int64_t>& shape) {
+    const int64_t n = header<E>(shape);
+    parallelChunks(n, sizeof(E), [&](int64_t beg, int64_t, std::vector<char>&) {
+        return (const char*)(data + beg);
+      });
+  }
+
+  template<class E>
+  void write(const E* data, int64_t n) {
+    write(data, std::vector<int64_t>(1, n));
+  }
+
+  // Append an array whose element i is gen(i), filling and writing
+  // independent slices on each thread.  'gen' must be thread-safe.
+  template<class E, class G>
+  void generate(const std::vector<int64_t>& shape, G gen) {
+    const int64_t n = header<E>(shape);
+    parallelChunks(n, sizeof(E), [&](int64_t beg, int64_t end, std::vector<char>& buf) {
+        buf.resize((end - beg) * sizeof(E));
+        E* out = (E*) buf.data();
+        for (int64_t i = beg; i < end; i++) {
+          out[i - beg] = gen(i);
+        }
+        return (const char*)out;
+      });
+  }
+
+  int64_t bytesWritten() const { return pos; }
+
+private:
+  template<class E>
+  int64_t header(const std::vector<int64_t>& shape) {
+    if (shape.size() > 255) {
+      throw std::invalid_argument("Futhark values have at most 255 dimensions");
+    }
+    std::vector<char> hdr(7 + 8 * shape.size());
+    hdr[0] = 'b';
+    hdr[1] = 2;
+    hdr[2] = (char)shape.size();
+    memcpy(&hdr[3], futhark_type_names[FutharkPrim<E>::type], 4);
+    int64_t n = 1;
+    for (size_t i = 0; i < shape.size(); i++) {
+      if (shape[i] < 0) {
+        throw std::invalid_argument("negative dimension in Futhark value");
+      }
+      if (shape[i] > 0 && n > INT64_MAX / (int64_t)sizeof(E) / shape[i]) {
+        throw std::invalid_argument("Futhark value too large");
+      }
+      memcpy(&hdr[7 + 8*i], &shape[i], sizeof(int64_t));
+      n *= shape[i];
+    }
+    const int err = writeAll(hdr.data(), hdr.size(), pos);
+    if (err != 0) {
+      throw std::runtime_error(std::string("write failed: ") + strerror(err));
+    }
+    pos += hdr.size();
+    return n;
+  }
+
+  // Splits [0,n) into slices of at least 1 MiB, one contiguous group
+  // per thread, and pwrite()s whatever 'slice' returns for each.
+  template<class S>
+  void parallelChunks(int64_t n, size_t el_size, S slice) {
+    const int64_t min_elems = std::max((int64_t)1, (int64_t)(1 << 20) / (int64_t)el_size);
+    const int nt = (int)std::max((int64_t)1, std::min((int64_t)T, n / min_elems));
+    const int64_t base = pos;
+    std::vector<std::thread> workers;
+    std::vector<int> errs(nt, 0);
+    auto work = [&](int tid) {
+      std::vector<char> buf;
+      const int64_t beg = n * tid / nt;
+      const int64_t end = n * (tid+1) / nt;
+      for (int64_t i = beg; i < end && errs[tid] == 0; i += 4*min_elems) {
+        const int64_t j = std::min(end, i + 4*min_elems);
+        const char* p = slice(i, j, buf);
+        errs[tid] = writeAll(p, (j - i) * el_size, base + i * el_size);
+      }
+    };
+    for (int tid = 1; tid < nt; tid++) {
+      workers.push_back(std::thread(work, tid));
+    }
+    work(0);
+    for (size_t i = 0; i < workers.size(); i++) {
+      workers[i].join();
+    }
+    pos += n * el_size;
+    for (int tid = 0; tid < nt; tid++) {
+      if (errs[tid] != 0) {
+        throw std::runtime_error(std::string("write failed: ") + strerror(errs[tid]));
+      }
+    }
+  }
+
+  int writeAll(const char* p, size_t len, int64_t off) {
+    while (len > 0) {
+      ssize_t r = pwrite(fd, p, len, off);
+      if (r < 0 && errno == EINTR) {
+        continue;
+      }
+      if (r <= 0) {
+        return r < 0 ? errno : EIO;
+      }
+      p += r; len -= r; off += r;
+    }
+    return 0;
+  }
+
+  int fd, T;
+  int64_t pos;
+};
+
+}
@@ -0,0 +1,116 @@
+// Sustainable memory bandwidth of the CPUs, measured STREAM-style.
+//
+// On inputs much larger than the cache, a histogram pass is bound by
+// how fast it can stream its input (once per chunk) and its
+// subhistograms (initialised, then read by the reduction) through
+// memory, so whether a runtime is good depends on the machine.  The
+// drivers therefore divide the bytes that a pass moves (see
+// HostGenHist::trafficBytes) by its runtime, and compare the GB/s to
+// what the memory system sustains here.
+//
+// The reference is measured with the four kernels of the STREAM
+// benchmark over arrays of doubles that are several times the size of
+// the last-level caches, split evenly over the threads of a
+// WorkerPool, which first-touch their own part:
+//
+//   copy   a[i] = b[i]              16 bytes per element
+//   scale  a[i] = s * b[i]          16
+//   add    a[i] = b[i] + c[i]       24
+//   triad  a[i] = b[i] + s * c[i]   24
+//
+// Each kernel is timed a few times and the best time is kept.  As in
+// STREAM, only the bytes that the program reads and writes are
+// counted, not the write-allocate reads of the caches.  This is the
+// CPU counterpart of naiveMemcpy in the benchmarks' scan-kernels.cu.h.
+//
+// systemBandwidth() measures once per process, on the default pool,
+// which takes a fraction of a second.
+
+#pragma once
+
+#include "genhist-pool.h"
+#include "genhist-topology.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <memory>
+
+namespace genhist {
+
+// GB/s (10^9 bytes per second) of the four STREAM kernels.
+struct StreamBandwidth
+{
+  double copy, scale, add, triad;
+
+  double peak() const { return std::max(std::max(copy, scale), std::max(add, triad)); }
+};
+
+// Run the STREAM kernels on all threads of 'pool' over arrays of 'n'
+// doubles, 'reps' times each.
+inline StreamBandwidth measureBandwidth(WorkerPool& pool, int64_t n, int reps = 5) {
+  const int T = pool.numThreads();
+  std::unique_ptr<double[]> a(new double[n]), b(new double[n]), c(new double[n]);
+  double* const pa = a.get();
+  double* const pb = b.get();
+  double* const pc = c.get();
+  pool.run([&](int tid) {
+      for (int64_t i = n * tid / T; i < n * (tid+1) / T; i++) {
+        pa[i] = 1.0;
+        pb[i] = 2.0;
+        pc[i] = 0.0;
+      }
+    });
+
+  const double s = 3.0;
+  double best[4];
+  std::fill(best, best + 4, std::numeric_limits<double>::infinity());
+  for (int r = 0; r < reps; r++) {
+    for (int k = 0; k < 4; k++) {
+      const std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+      pool.run([&](int tid) {
+          const int64_t beg = n * tid / T, end = n * (tid+1) / T;
+          if (k == 0) {
+            for (int64_t i = beg; i < end; i++) {
+              pc[i] = pa[i];
+            }
+          } else if (k == 1) {
+            for (int64_t i = beg; i < end; i++) {
+              pb[i] = s * pc[i];
+            }
+          } else if (k == 2) {
+            for (int64_t i = beg; i < end; i++) {
+              pc[i] = pa[i] + pb[i];
+            }
+          } else {
+            for (int64_t i = beg; i < end; i++) {
+              pa[i] = pb[i] + s * pc[i];
+            }
+          }
+        });
+      best[k] = std::min(best[k], std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count());
+    }
+  }
+
+  const double bytes = (double)n * sizeof(double);
+  const StreamBandwidth bw = { 2 * bytes / best[0] / 1e9, 2 * bytes / best[1] / 1e9,
+                               3 * bytes / best[2] / 1e9, 3 * bytes / best[3] / 1e9 };
+  return bw;
+}
+
+// The bandwidth of the default pool, over arrays four times the size
+// of all last-level caches together (at least 32 MiB, at most 512 MiB
+// each).  Measured on the first call.
+inline const StreamBandwidth& systemBandwidth() {
+  static const StreamBandwidth bw = [] {
+    const CpuTopology& topo = CpuTopology::system();
+    const int64_t llcs = std::max(1, (int)topo.cpus.size() / std::max(1, topo.llc_threads));
+    const int64_t bytes = std::min((int64_t)512 << 20,
+                                   std::max((int64_t)32 << 20, 4 * llcs * (int64_t)topo.llc_bytes));
+    return measureBandwidth(WorkerPool::defaultPool(), bytes / sizeof(double));
+  }();
+  return bw;
+}
+
+}
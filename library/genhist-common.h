@@ -0,0 +1,174 @@
+// Definitions shared between the CUDA library (genhist.cu.h) and the
+// multicore CPU library (genhist-host.h).
+//
+// A histogram descriptor written against HistDescriptor can be used
+// with both libraries, as long as 'f', 'ne', and 'opScal' are
+// declared with GENHIST_HOSTDEV (or '__device__ __host__' when
+// compiling with nvcc).
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+
+#ifdef __CUDACC__
+#define GENHIST_HOSTDEV __device__ __host__
+#else
+#define GENHIST_HOSTDEV
+#endif
+
+namespace genhist {
+
+enum AtomicPrim {HDW, CAS, XCG};
+
+template<class T>
+struct indval {
+  uint32_t index;
+  T value;
+};
+
+template<typename A, typename B>
+struct HistDescriptor {
+  // Input array element type.
+  typedef A ALPHA;
+
+  // Histogram element type.
+  typedef B BETA;
+
+  // Compute an (index,value) pair given an input element.
+  GENHIST_HOSTDEV inline static
+  genhist::indval<BETA> f(const int32_t H, ALPHA pixel);
+
+  // Neutral element.
+  GENHIST_HOSTDEV inline static
+  BETA ne();
+
+  // Apply binary operator.
+  GENHIST_HOSTDEV inline static
+  BETA opScal(BETA v1, BETA v2);
+
+  // What kind of atomic strategy do we need?
+  GENHIST_HOSTDEV inline static
+  genhist::AtomicPrim atomicKind();
+
+#ifdef __CUDACC__
+  // Apply binary operator atomically on memory location.  Only
+  // needed by the CUDA library; the CPU library derives its atomic
+  // update from 'atomicKind' and 'opScal'.
+  __device__ inline static
+  void opAtom(volatile BETA* hist, volatile int* locks, int32_t idx, BETA v);
+#endif
+};
+
+// Division by a run-time constant
+//
+// Index functions such as 'pixel % max(1, H/RF)' divide by a value
+// that is only known at run time but is the same for every element.
+// FastDiv precomputes a magic number for a divisor d > 0, after which
+// n / d and n % d take a multiplication, a subtraction and shifts
+// instead of a division (the method of Granlund and Montgomery, as in
+// libdivide).  Both are exact for every uint32_t n, and are plain
+// integer arithmetic, so loops over arrays of n vectorize.
+
+struct FastDiv {
+  uint32_t d, magic;
+  int sh1, sh2;
+
+  GENHIST_HOSTDEV FastDiv() : d(1), magic(1), sh1(0), sh2(0) { }
+
+  GENHIST_HOSTDEV explicit FastDiv(uint32_t d) : d(d) {
+    int l = 0; // ceil(log2(d))
+    while (l < 32 && ((uint64_t)1 << l) < d) {
+      l++;
+    }
+    magic = (uint32_t)(((uint64_t)1 << 32) * (((uint64_t)1 << l) - d) / d + 1);
+    sh1 = l < 1 ? l : 1;
+    sh2 = l > 1 ? l - 1 : 0;
+  }
+
+  GENHIST_HOSTDEV inline uint32_t div(uint32_t n) const {
+    const uint32_t t = (uint32_t)(((uint64_t)magic * n) >> 32);
+    return (t + ((n - t) >> sh1)) >> sh2;
+  }
+
+  GENHIST_HOSTDEV inline uint32_t mod(uint32_t n) const {
+    return n - div(n) * d;
+  }
+};
+
+// Batched index functions
+//
+// A descriptor may also compute the (index, value) pairs of n elements
+// at once, into separate arrays, with a member
+//
+//   void fBatch(int32_t H, const ALPHA* xs, int n, uint32_t* idx, BETA* vals) const;
+//
+// (which may also be static).  Written as a simple loop, typically with
+// a FastDiv, it lets the compiler vectorize the index computation.  The
+// CPU library calls it through evalBatch, which falls back to 'f'.
+
+template<class HP, class = void>
+struct HasFBatch {
+  static const bool value = false;
+};
+
+template<class HP>
+struct HasFBatch<HP, decltype((void)std::declval<const HP&>().fBatch(
+                               (int32_t)0, (const typename HP::ALPHA*)0, 0,
+                               (uint32_t*)0, (typename HP::BETA*)0))> {
+  static const bool value = true;
+};
+
+template<class HP>
+inline typename std::enable_if<HasFBatch<HP>::value>::type
+evalBatch(const HP& desc, int32_t H, const typename HP::ALPHA* xs, int n,
+          uint32_t* idx, typename HP::BETA* vals) {
+  desc.fBatch(H, xs, n, idx, vals);
+}
+
+template<class HP>
+inline typename std::enable_if<!HasFBatch<HP>::value>::type
+evalBatch(const HP& desc, int32_t H, const typename HP::ALPHA* xs, int n,
+          uint32_t* idx, typename HP::BETA* vals) {
+  for (int i = 0; i < n; i++) {
+    const indval<typename HP::BETA> iv = desc.f(H, xs[i]);
+    idx[i] = iv.index;
+    vals[i] = iv.value;
+  }
+}
+
+// Run-length pre-aggregation
+//
+// Inputs such as images often map long runs of consecutive elements
+// to the same bin.  Both libraries can then combine each run with
+// 'opScal' before updating the histogram, which divides the number of
+// (atomic) updates to hot bins by the run length.  Whether to do so is
+// decided by sampling: pre-aggregation is used when the estimated
+// average run length is at least 'run_length_min'.
+
+const float run_length_min = 2.0f;
+
+// Estimate the average length of the runs of elements with the same
+// bin index among elem(0), ..., elem(n-1), from 'windows' evenly
+// spaced windows of 'width' consecutive elements each.
+template<class HP, class E>
+float sampleRunLength(const HP& desc, int32_t H, int64_t n, E elem,
+                      int windows = 8, int width = 512) {
+  int64_t elems = 0, runs = 0;
+  for (int w = 0; w < windows; w++) {
+    const int64_t beg = n * w / windows;
+    const int64_t end = std::min(n, beg + width);
+    uint32_t prev = 0;
+    for (int64_t i = beg; i < end; i++) {
+      const uint32_t idx = desc.f(H, elem(i)).index;
+      runs += (i == beg || idx != prev);
+      prev = idx;
+    }
+    elems += end - beg;
+  }
+  return runs > 0 ? (float)elems / runs : 1.0f;
+}
+
+}
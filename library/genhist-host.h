@@ -0,0 +1,1116 @@
+// Single-header library for computing generalized histograms on
+// multicore CPUs.
+//
+// This is the host-side counterpart of genhist.cu.h and accepts the
+// same histogram descriptors (see genhist-common.h).  See
+// example-host.cpp for an example of how to use it.
+//
+// The HostGenHistConfig class plays the role of GenHistConfig: it
+// describes the cache hierarchy that the cost model should target, and
+// optionally a memory budget that the subhistograms must fit in (the
+// planner then uses fewer, more shared, subhistograms) and the page
+// size to request for them (see genhist-pages.h).
+// The 'host_default' variable contains parameters that are a
+// reasonable starting point for contemporary x86 servers.
+//
+// The main entry point is the class HostGenHist, which encapsulates
+// the subhistogram buffers for computing generalized histograms for a
+// certain number of bins, expected input length, and histogram
+// descriptor.  Like its GPU counterpart, it follows the cooperation
+// scheme from the paper: T worker threads share M subhistograms, so
+// C = ceil(T/M) threads update each subhistogram.  When C is one,
+// updates are plain read-modify-writes; otherwise they are performed
+// with the atomic strategy given by the descriptor's 'atomicKind':
+// HDW and CAS both use a compare-and-swap loop around 'opScal', while
+// XCG uses a spin lock per bin.
+//
+// The worker threads come from a persistent WorkerPool (see
+// genhist-pool.h), which balances the input between them by
+// work-stealing over blocks.  Small inputs are processed by the
+// calling thread alone.
+//
+// With 'topology_coop', and a pool pinned along CpuTopology (see
+// genhist-topology.h), C is instead picked among the sizes of the
+// sharing domains (a thread, a core, an L2 cluster, a last-level
+// cache): the smallest one for which the subhistograms of the groups
+// in every L2 and last-level cache fit in those caches, in the same
+// sense as the cost model.  Groups then never span a last-level cache
+// or a socket.
+//
+// The descriptor is stored by value in the engine and all of 'f',
+// 'ne', and 'opScal' are invoked through it, so descriptors may carry
+// run-time state (the usual static member functions work unchanged).
+// Elements whose index is not below H update no bin, as in Futhark's
+// reduce_by_index.
+//
+// 'execInto' folds the histogram into a histogram owned by the caller
+// (like 'reduce_by_index dest' in Futhark) rather than into the
+// engine's own result.
+//
+// Input elements may also be generated from their index instead of
+// read from memory (see 'execGenerate'), which avoids materialising
+// inputs such as the N*N pairs of an all-pairs computation.
+//
+// Consecutive updates to the same bin are combined before they reach
+// the subhistogram when sampling shows long runs (see
+// sampleRunLength in genhist-common.h).
+//
+// When the active part of the subhistograms does not fit in the cache
+// fraction targeted by the cost model, every update is likely a cache
+// miss that the next one does not depend on.  The update loop is then
+// software-pipelined: the index of each element is computed and its
+// bin prefetched 'prefetch_distance' elements before the update is
+// applied.  By default the distance is measured once per process (see
+// tunedPrefetchDistance).
+//
+// The subhistograms share one buffer, laid out in one of three ways
+// (SubhistoLayout): BLOCKED places them back to back, so that the
+// cache lines at their boundaries are shared between the threads of
+// neighbouring subhistograms; PADDED rounds each up to whole cache
+// lines; INTERLEAVED stores the first cache line of every
+// subhistogram, then the second, and so on, which keeps each line
+// private to one subhistogram and lets the final reduction read
+// consecutive lines.  Small histograms updated by many threads are
+// sensitive to false sharing in BLOCKED; 'tuneLayout' times the three.
+//
+// Descriptors that declare 'simd_add' are updated with AVX-512 or AVX2
+// gathers and scatters when the subhistograms are private to their
+// threads (see genhist-simd.h).  Descriptors may also compute the
+// pairs of a batch of elements at once with an 'fBatch' (see
+// genhist-common.h).
+//
+// Subhistograms are initialised to 'ne' a cache line (a tile) at a
+// time.  Every tile of every subhistogram carries the number of the
+// last pass that initialised it, so a pass can start by bumping the
+// pass number instead of rewriting the buffer: when a pass has fewer
+// elements than the subhistograms have bins and the subhistograms are
+// private (C is one), tiles are initialised on their first update, and
+// the final reduction skips the tiles that the pass did not touch.  A
+// single thread updates the result directly.  Repeated small
+// 'accumulate' calls on a large histogram then cost in proportion to
+// their input rather than to M*H.
+//
+// For tuning, the updates (and their retries under contention) of
+// every bin can be counted into a BinProfile (see setProfile and
+// genhist-profile.h), and its phases traced on a timeline (see
+// setTracer and genhist-trace.h), and hardware counters can be read
+// around every pass (see setCounters and genhist-perf.h).  The memory
+// traffic of a pass (trafficBytes) over its runtime gives the GB/s to
+// compare with the STREAM bandwidth of genhist-bandwidth.h.
+//
+// Scalar side reductions (sums, minima, maxima, counts, ...) can be
+// computed in the same pass over the input as the histogram, instead
+// of in separate passes before or after it; see SideReduce.
+
+#pragma once
+
+#include "genhist-common.h"
+#include "genhist-bandwidth.h"
+#include "genhist-pages.h"
+#include "genhist-perf.h"
+#include "genhist-pool.h"
+#include "genhist-profile.h"
+#include "genhist-simd.h"
+#include "genhist-topology.h"
+#include "genhist-trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace genhist {
+
+enum SubhistoLayout {BLOCKED, INTERLEAVED, PADDED};
+
+inline const char* subhistoLayoutName(SubhistoLayout l) {
+  return l == INTERLEAVED ? "interleaved" : l == PADDED ? "padded" : "blocked";
+}
+
+// The fields are not const, so that the with* functions below copy a
+// configuration and change one field without listing the others.
+struct HostGenHistConfig
+{
+  float k_RF;
+  float L2Fract;
+  int LLCache;  // size in bytes of the last-level (shared) cache
+  int CLelmsz;  // how many elements fit on a cache line
+  int glb_k_min;
+  int num_threads;   // zero means that of the default WorkerPool
+  size_t mem_budget; // bytes for subhistograms, locks and result, rounded to
+                     // the pages they map; zero means no limit
+  PagePolicy pages;  // requested for subhistograms and locks
+  int prefetch_distance; // zero means tuned, when the subhistograms exceed the cache;
+                         // negative means never prefetch
+  SubhistoLayout layout;
+  bool topology_coop; // form cooperation groups along cache-sharing domains
+  SimdLevel simd;     // the widest SIMD kernel to use, if the CPU supports it
+};
+
+const HostGenHistConfig host_default{ 0.75, 0.4, 8192*1024, 16, 2, 0, 0, TRANSPARENT_HUGE, 0, PADDED, true,
+                                      SIMD_AVX512 };
+
+// A copy of 'c' with another subhistogram layout.
+inline HostGenHistConfig withLayout(const HostGenHistConfig& c, SubhistoLayout layout) {
+  HostGenHistConfig r = c;
+  r.layout = layout;
+  return r;
+}
+
+// A copy of 'c' with another memory budget.
+inline HostGenHistConfig withBudget(const HostGenHistConfig& c, size_t mem_budget) {
+  HostGenHistConfig r = c;
+  r.mem_budget = mem_budget;
+  return r;
+}
+
+// A copy of 'c' with another number of threads.
+inline HostGenHistConfig withThreads(const HostGenHistConfig& c, int num_threads) {
+  HostGenHistConfig r = c;
+  r.num_threads = num_threads;
+  return r;
+}
+
+// A copy of 'c' with another prefetch distance.
+inline HostGenHistConfig withPrefetch(const HostGenHistConfig& c, int prefetch_distance) {
+  HostGenHistConfig r = c;
+  r.prefetch_distance = prefetch_distance;
+  return r;
+}
+
+// A copy of 'c' with or without cooperation along the topology.
+inline HostGenHistConfig withTopologyCoop(const HostGenHistConfig& c, bool topology_coop) {
+  HostGenHistConfig r = c;
+  r.topology_coop = topology_coop;
+  return r;
+}
+
+// A copy of 'c' with another widest SIMD kernel.
+inline HostGenHistConfig withSimd(const HostGenHistConfig& c, SimdLevel simd) {
+  HostGenHistConfig r = c;
+  r.simd = simd;
+  return r;
+}
+
+// Largest prefetch distance of the pipelined update loop; distances
+// are powers of two.
+const int prefetch_distance_max = 64;
+
+// The prefetch distance, in elements, for which random increments
+// into a table much larger than the last-level cache run fastest on
+// this machine.  This is roughly the memory latency divided by the
+// time per update.  Zero if prefetching does not help.  Measured on
+// the first call, which takes a few tens of milliseconds.
+inline int tunedPrefetchDistance() {
+  static const int best = [] {
+    const int64_t bins = (int64_t)8 << 20; // 32 MiB
+    const int64_t n = (int64_t)1 << 18;
+    std::vector<int32_t> table(bins, 0);
+    std::vector<uint32_t> idx(n + prefetch_distance_max);
+    uint32_t seed = 0x9e3779b9;
+    for (size_t i = 0; i < idx.size(); i++) {
+      seed = seed * 1664525 + 1013904223;
+      idx[i] = (seed >> 8) % bins;
+    }
+    int best_d = 0;
+    double best_t = std::numeric_limits<double>::infinity();
+    for (int d = 0; d <= prefetch_distance_max; d = d ? 2*d : 1) {
+      const std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+      for (int64_t i = 0; i < n; i++) {
+        if (d > 0) {
+          __builtin_prefetch(&table[idx[i + d]], 1);
+        }
+        table[idx[i]]++;
+      }
+      const double t = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+      // a distance must win clearly to be worth the pipeline
+      if (t < 0.95 * best_t) {
+        best_t = t;
+        best_d = d;
+      }
+    }
+    return best_d;
+  }();
+  return best;
+}
+
+// Atomic update of a single bin in a subhistogram that is shared by
+// several threads.  Returns the number of failed attempts (lock
+// acquisitions or compare-and-swaps).
+template<class HP>
+inline static int
+hostOpAtom(const HP& desc, typename HP::BETA* hist, int32_t* locks, int64_t idx, typename HP::BETA v) {
+  typedef typename HP::BETA BETA;
+  int retries = 0;
+  if (desc.atomicKind() == XCG) {
+    while (__atomic_exchange_n(&locks[idx], 1, __ATOMIC_ACQUIRE) != 0) {
+      retries++;
+      while (__atomic_load_n(&locks[idx], __ATOMIC_RELAXED) != 0) { }
+    }
+    hist[idx] = desc.opScal(hist[idx], v);
+    __atomic_store_n(&locks[idx], 0, __ATOMIC_RELEASE);
+  } else {
+    BETA old, upd;
+    __atomic_load(&hist[idx], &old, __ATOMIC_RELAXED);
+    upd = desc.opScal(old, v);
+    while (!__atomic_compare_exchange(&hist[idx], &old, &upd, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+      retries++;
+      upd = desc.opScal(old, v);
+    }
+  }
+  return retries;
+}
+
+// Side reductions
+//
+// A side reduction is a scalar reduction that is computed over the
+// same input as a histogram, in the same pass (see the 'exec' and
+// 'accumulate' overloads taking an SR).  It maps each input element to
+// a RES with 'map' and combines with the associative and commutative
+// 'op', whose neutral element is 'ne'.  Two side reductions are
+// computed together with Fused.
+
+template<typename A, typename R>
+struct SideReduce {
+  typedef A ALPHA;
+  typedef R RES;
+  inline static RES ne();
+  inline static RES map(ALPHA x);
+  inline static RES op(RES a, RES b);
+};
+
+template<typename A>
+struct NoSideReduce : SideReduce<A, char> {
+  inline static char ne() { return 0; }
+  inline static char map(A) { return 0; }
+  inline static char op(char, char) { return 0; }
+};
+
+template<typename A, typename R = A>
+struct SumReduce : SideReduce<A, R> {
+  inline static R ne() { return 0; }
+  inline static R map(A x) { return x; }
+  inline static R op(R a, R b) { return a + b; }
+};
+
+template<typename A>
+struct CountReduce : SideReduce<A, int64_t> {
+  inline static int64_t ne() { return 0; }
+  inline static int64_t map(A) { return 1; }
+  inline static int64_t op(int64_t a, int64_t b) { return a + b; }
+};
+
+template<typename A>
+struct MinReduce : SideReduce<A, A> {
+  inline static A ne() { return std::numeric_limits<A>::has_infinity ?
+      std::numeric_limits<A>::infinity() : std::numeric_limits<A>::max(); }
+  inline static A map(A x) { return x; }
+  inline static A op(A a, A b) { return std::min(a, b); }
+};
+
+template<typename A>
+struct MaxReduce : SideReduce<A, A> {
+  inline static A ne() { return std::numeric_limits<A>::has_infinity ?
+      -std::numeric_limits<A>::infinity() : std::numeric_limits<A>::lowest(); }
+  inline static A map(A x) { return x; }
+  inline static A op(A a, A b) { return std::max(a, b); }
+};
+
+template<class R1, class R2>
+struct Fused : SideReduce<typename R1::ALPHA, std::pair<typename R1::RES, typename R2::RES> > {
+  typedef std::pair<typename R1::RES, typename R2::RES> RES;
+  R1 r1;
+  R2 r2;
+  inline RES ne() const { return RES(r1.ne(), r2.ne()); }
+  inline RES map(typename R1::ALPHA x) const { return RES(r1.map(x), r2.map(x)); }
+  inline RES op(const RES& a, const RES& b) const {
+    return RES(r1.op(a.first, b.first), r2.op(a.second, b.second));
+  }
+};
+
+template<typename A>
+struct MinMaxReduce : Fused<MinReduce<A>, MaxReduce<A> > { };
+
+template<class HP>
+class HostGenHist
+{
+public:
+  typedef typename HP::ALPHA ALPHA;
+  typedef typename HP::BETA BETA;
+
+  static const uint32_t none = 0xffffffff;
+
+  // Inputs of at most this many elements are processed sequentially
+  // by the calling thread, directly into the result.
+  static const int64_t serial_max = 16384;
+
+  // Elements per batch of the batched update loop, which is used with
+  // the SIMD kernels and for descriptors with an 'fBatch'.
+  static const int batch_size = 64;
+
+  // The engine runs on 'pool' if given, and otherwise on the default
+  // pool (or a private one if consts.num_threads differs from it).
+  HostGenHist(HostGenHistConfig consts, int RF, int H, int64_t N, HP desc = HP(),
+              WorkerPool* pool = NULL)
+    : HostGenHist(consts, RF, H, N, 0, 0, desc, pool) { }
+
+  // An engine with 'fixed_M' subhistograms (at most one per thread)
+  // and 'fixed_chunks' chunks instead of those of the cost model, for
+  // exploring the design space (see prototype/histo-host.cpp); zero
+  // keeps the planned value.  consts.mem_budget is not applied to a
+  // fixed M.
+  HostGenHist(HostGenHistConfig consts, int RF, int H, int64_t N, int fixed_M, int fixed_chunks,
+              HP desc = HP(), WorkerPool* pool = NULL)
+    : consts(consts), desc(desc), RF(RF), run_length(1), prefetch_dist(0), simd(SIMD_SCALAR),
+      H(H), N(N), pass(0), lazy(false), init_bins(0), traffic(0), prof(NULL), tracer(NULL) {
+    if (fixed_M < 0 || fixed_chunks < 0) {
+      throw std::invalid_argument("HostGenHist: negative number of subhistograms or chunks");
+    }
+    this->pool = selectPool(pool, consts.num_threads, owned_pool);
+    T = this->pool->numThreads();
+    if (fixed_M > 0) {
+      // (the budget could only reject the planned M)
+      plan(withBudget(consts, 0), desc, T, this->pool->followsTopology(), RF, H, N, M, C, num_chunks);
+      M = std::min(fixed_M, T);
+      C = (T + M - 1) / M;
+    } else {
+      plan(consts, desc, T, this->pool->followsTopology(), RF, H, N, M, C, num_chunks);
+    }
+    if (fixed_chunks > 0) {
+      num_chunks = std::min(fixed_chunks, std::max(H, 1));
+    }
+    lay = layoutOf(consts.layout, H, M);
+    tile_pass.assign((size_t)M * lay.tiles, 0);
+
+    histos_buf = pageAlloc((size_t)lay.bins * sizeof(BETA), consts.pages);
+    histos = (BETA*) histos_buf.ptr;
+    histo  = (BETA*) alignedAlloc((size_t)H * sizeof(BETA));
+    locks_buf.ptr = NULL;
+    locks  = NULL;
+    if (desc.atomicKind() == XCG && C > 1) {
+      locks_buf = pageAlloc((size_t)lay.bins * sizeof(int32_t), consts.pages);
+      locks = (int32_t*) locks_buf.ptr;
+      memset(locks, 0, (size_t)lay.bins * sizeof(int32_t));
+    }
+    reset();
+  }
+
+  ~HostGenHist() {
+    pageFree(histos_buf);
+    free(histo);
+    pageFree(locks_buf);
+  }
+
+  HostGenHist(const HostGenHist&) = delete;
+  HostGenHist& operator=(const HostGenHist&) = delete;
+
+  // Compute the histogram of the N elements given at construction.
+  void exec(const ALPHA* input) {
+    reset();
+    accumulate(input, N);
+  }
+
+  // Compute the histogram of the N elements given at construction,
+  // and the side reduction 'sr' over the same elements in the same
+  // pass over the input.
+  template<class SR>
+  typename SR::RES exec(const ALPHA* input, SR sr) {
+    reset();
+    return accumulate(input, N, sr);
+  }
+
+  // Fold the histogram of the N elements given at construction into
+  // the H bins of 'dest' (like 'reduce_by_index dest' in Futhark),
+  // instead of into a fresh result, which is left unchanged.
+  void execInto(BETA* dest, const ALPHA* input) {
+    execInto(dest, input, NoSideReduce<ALPHA>());
+  }
+
+  template<class SR>
+  typename SR::RES execInto(BETA* dest, const ALPHA* input, SR sr) {
+    return run(N, [input](int64_t i) { return input[i]; }, sizeof(ALPHA), sr, dest);
+  }
+
+  // Fold the histogram of 'n' further input elements into the
+  // current result.  'n' need not match the N used for planning,
+  // which makes this the entry point for blocked/streaming drivers.
+  void accumulate(const ALPHA* input, int64_t n) {
+    accumulate(input, n, NoSideReduce<ALPHA>());
+  }
+
+  // As above, and also return the side reduction 'sr' of the 'n'
+  // elements, computed while they are read for the histogram.
+  template<class SR>
+  typename SR::RES accumulate(const ALPHA* input, int64_t n, SR sr) {
+    return run(n, [input](int64_t i) { return input[i]; }, sizeof(ALPHA), sr, histo);
+  }
+
+  // Compute the histogram of the elements gen(0), ..., gen(n-1),
+  // where 'gen' maps an int64_t index to an ALPHA, without storing
+  // them (like 'tabulate n gen' followed by 'reduce_by_index' in
+  // Futhark).  Workers call 'gen' on contiguous blocks of indices,
+  // each in increasing order, and possibly more than once per
+  // index when the histogram is split into several chunks; 'gen' must
+  // therefore be pure and safe to call concurrently.
+  template<class G>
+  void execGenerate(int64_t n, G gen) {
+    reset();
+    accumulateGenerate(n, gen);
+  }
+
+  template<class G, class SR>
+  typename SR::RES execGenerate(int64_t n, G gen, SR sr) {
+    reset();
+    return accumulateGenerate(n, gen, sr);
+  }
+
+  // Fold the histogram of gen(0), ..., gen(n-1) into the current result.
+  template<class G>
+  void accumulateGenerate(int64_t n, G gen) {
+    run(n, gen, 0, NoSideReduce<ALPHA>(), histo);
+  }
+
+  template<class G, class SR>
+  typename SR::RES accumulateGenerate(int64_t n, G gen, SR sr) {
+    return run(n, gen, 0, sr, histo);
+  }
+
+  // Set every bin of the result to the neutral element.
+  void reset() {
+    std::fill(histo, histo + H, desc.ne());
+  }
+
+  const BETA* result() const {
+    return histo;
+  }
+
+  int numThreads() const { return T; }
+  int numSubhistos() const { return M; }
+  int numCooperating() const { return C; }
+
+  // The page size policy that took effect for the subhistograms, and
+  // how many of their bytes are backed by huge pages (see
+  // hugePageBytes in genhist-pages.h).
+  PagePolicy pagePolicy() const { return histos_buf.policy; }
+  size_t hugeBytes() const { return hugePageBytes(histos_buf); }
+  int numChunks() const { return num_chunks; }
+
+  // Bytes allocated by this engine, including the rounding of huge
+  // page buffers to whole pages.
+  size_t bytesAllocated() const {
+    return histos_buf.bytes + (locks_buf.ptr ? locks_buf.bytes : 0) +
+      tile_pass.size() * sizeof(uint16_t) + (size_t)H * sizeof(BETA);
+  }
+
+  SubhistoLayout layout() const { return consts.layout; }
+
+  // Bytes that an engine constructed with these arguments (and the
+  // default pool, unless consts.num_threads is set) would allocate,
+  // taking consts.mem_budget into account.  Throws like the
+  // constructor if the budget cannot be met.
+  static size_t bytesRequired(HostGenHistConfig consts, int RF, int H, int64_t N, HP desc = HP()) {
+    const WorkerPool& dflt = WorkerPool::defaultPool();
+    const bool own = consts.num_threads > 0 && consts.num_threads != dflt.numThreads();
+    // (selectPool would construct a pinned pool of num_threads)
+    const int T = own ? consts.num_threads : dflt.numThreads();
+    const bool topo = own ? WorkerPool::followsTopology(T, true) : dflt.followsTopology();
+    int M, C, num_chunks;
+    plan(consts, desc, T, topo, RF, H, N, M, C, num_chunks);
+    return footprint(desc, H, M, T, consts.layout, consts.pages);
+  }
+
+  // Time 'reps' executions over the N elements of 'input' with each
+  // subhistogram layout, and return the fastest layout.
+  static SubhistoLayout tuneLayout(HostGenHistConfig consts, int RF, int H, int64_t N,
+                                   const ALPHA* input, HP desc = HP(), WorkerPool* pool = NULL,
+                                   int reps = 3) {
+    const SubhistoLayout layouts[3] = {BLOCKED, INTERLEAVED, PADDED};
+    SubhistoLayout best = consts.layout;
+    double best_t = std::numeric_limits<double>::infinity();
+    for (int l = 0; l < 3; l++) {
+      HostGenHist engine(withLayout(consts, layouts[l]), RF, H, N, desc, pool);
+      engine.exec(input); // warm up
+      const std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+      for (int r = 0; r < reps; r++) {
+        engine.exec(input);
+      }
+      const double t = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+      if (t < best_t) {
+        best_t = t;
+        best = layouts[l];
+      }
+    }
+    return best;
+  }
+
+  // The average run length sampled by the last pass, and whether it
+  // was high enough to pre-aggregate runs.
+  float runLength() const { return run_length; }
+  bool preAggregated() const { return run_length >= run_length_min; }
+
+  // The prefetch distance used by the last pass; zero if it did not
+  // prefetch.
+  int prefetchDistance() const { return prefetch_dist; }
+
+  // The SIMD kernel used by the last pass.
+  SimdLevel simdLevel() const { return simd; }
+
+  // Count the updates of every bin, and their retries, into 'profile'
+  // during subsequent passes (which then do not use the SIMD
+  // kernels); NULL stops profiling.  An empty profile is resized to H
+  // bins.
+  void setProfile(BinProfile* profile) {
+    if (profile && profile->numBins() == 0) {
+      *profile = BinProfile(H);
+    }
+    if (profile && profile->numBins() != (int32_t)H) {
+      throw std::invalid_argument("HostGenHist::setProfile: profile has the wrong number of bins");
+    }
+    prof = profile;
+  }
+
+  // Record the phases of subsequent passes, and the blocks of every
+  // worker, on 't' (see genhist-trace.h); NULL stops tracing.
+  void setTracer(Tracer* t) {
+    tracer = t;
+    if (t) {
+      t->nameTrack(0, "caller");
+      for (int tid = 1; tid < T; tid++) {
+        t->nameTrack(tid, "worker " + std::to_string(tid));
+      }
+    }
+  }
+
+  // Count hardware events (see genhist-perf.h) on the thread that runs
+  // each pass and every worker during subsequent passes, or stop
+  // counting.  Returns whether every thread could open counters; if
+  // not, passes run uncounted and countersError() tells why.
+  bool setCounters(bool on) {
+    perf.clear();
+    perf_sample = PerfSample();
+    perf_error.clear();
+    if (!on) {
+      return false;
+    }
+    std::vector<std::unique_ptr<PerfGroup> > groups(T);
+    pool->run([&](int tid) {
+        groups[tid].reset(new PerfGroup());
+        groups[tid]->open();
+      });
+    for (int tid = 0; tid < T; tid++) {
+      if (!groups[tid]->available()) {
+        perf_error = groups[tid]->error();
+        return false;
+      }
+    }
+    perf.swap(groups);
+    perf_caller = std::this_thread::get_id();
+    return true;
+  }
+
+  // The hardware counts of the last pass, summed over all threads.
+  const PerfSample& counters() const { return perf_sample; }
+  const std::string& countersError() const { return perf_error; }
+
+  // The bytes of memory that the last pass had to move, to compare
+  // with the bandwidth of the machine (see genhist-bandwidth.h): its
+  // input, once per chunk and not at all if generated, the bins of the
+  // output, read and written, and the subhistogram bins that it
+  // initialised and then read in the reduction.  Traffic that the
+  // caches absorb is included, and misses on the updates themselves
+  // are not, so this is a lower bound only for large inputs.
+  int64_t trafficBytes() const { return traffic; }
+
+  // Whether the last pass initialised tiles on first touch, and the
+  // number of subhistogram bins that it initialised.
+  bool lazyInit() const { return lazy; }
+  int64_t initializedBins() const { return init_bins; }
+
+private:
+  // The calling thread is tid 0 of the pass, but the counters of tid 0
+  // belong to the thread that called setCounters: reopen them here if
+  // that was another thread.
+  void countCaller() {
+    if (perf.empty() || perf_caller == std::this_thread::get_id()) {
+      return;
+    }
+    std::unique_ptr<PerfGroup> group(new PerfGroup());
+    if (!group->open()) {
+      perf_error = group->error();
+      perf.clear();
+      perf_sample = PerfSample();
+      return;
+    }
+    perf[0].swap(group);
+    perf_caller = std::this_thread::get_id();
+  }
+
+  // The histogram pass proper, over elements elem(0), ..., elem(n-1),
+  // folded into the H bins of 'out'.  Each element read costs
+  // 'elem_bytes' of memory traffic (zero if they are generated).
+  template<class E, class SR>
+  typename SR::RES run(int64_t n, E elem, int64_t elem_bytes, SR sr, BETA* out) {
+    typedef typename SR::RES RES;
+    traffic = 0;
+    if (n <= 0) {
+      return sr.ne();
+    }
+    TraceScope pass_scope(tracer, "pass", "genhist", 0, "elements", n);
+    countCaller();
+    PerfScope perf_scope(perf, perf_sample);
+    if (n <= serial_max) {
+      run_length = 1;
+      prefetch_dist = 0;
+      simd = SIMD_SCALAR;
+      lazy = false;
+      init_bins = 0;
+      RES side = sr.ne();
+      for (int64_t i = 0; i < n; i++) {
+        const ALPHA x = elem(i);
+        side = sr.op(side, sr.map(x));
+        struct indval<BETA> iv = desc.f(H, x);
+        if (iv.index >= (uint32_t)H) {
+          continue;
+        }
+        out[iv.index] = desc.opScal(out[iv.index], iv.value);
+        if (prof) {
+          prof->record(iv.index, 0);
+        }
+      }
+      traffic = n * elem_bytes + 2 * std::min(n, (int64_t)H) * (int64_t)sizeof(BETA);
+      return side;
+    }
+    std::vector<RES> partials(T, sr.ne());
+    const int32_t H_chk = (H + num_chunks - 1) / num_chunks;
+    {
+      TraceScope scope(tracer, "sample", "genhist", 0);
+      run_length = sampleRunLength(desc, H, n, elem);
+    }
+    const bool pre_aggregate = run_length >= run_length_min;
+    prefetch_dist = choosePrefetch(H_chk);
+    const int dist = prefetch_dist;
+    simd = SimdAdd<HP>::value && C == 1 && dist == 0 && !pre_aggregate && lay.bins <= INT32_MAX && !prof ?
+      std::min(consts.simd, detectSimd()) : SIMD_SCALAR;
+    const SimdSlots slots = { lay.shift, (int32_t)lay.group, lay.mask };
+    // (runs are combined faster one element at a time)
+    const bool batched = simd != SIMD_SCALAR || (HasFBatch<HP>::value && dist == 0 && !pre_aggregate);
+    const int64_t block = std::max((int64_t)4096, n / (16 * T));
+
+    // a single private subhistogram is the output itself (its layout
+    // is then the identity)
+    const bool direct = M == 1 && C == 1;
+    lazy = !direct && C == 1 && n < lay.bins;
+    std::vector<int64_t> touched(T, 0);
+    if (!direct) {
+      // start a pass: every tile is stale until initialised here or on
+      // its first update
+      if (++pass == 0) {
+        std::fill(tile_pass.begin(), tile_pass.end(), 0);
+        pass = 1;
+      }
+      if (!lazy) {
+        TraceScope scope(tracer, "init", "genhist", 0, "bins", lay.bins);
+        pool->run([&](int tid) {
+            std::fill(histos + lay.bins * tid / T, histos + lay.bins * (tid+1) / T, desc.ne());
+          });
+        std::fill(tile_pass.begin(), tile_pass.end(), pass);
+      }
+    }
+
+    for (int k = 0; k < num_chunks; k++) {
+      const uint32_t chunk_beg = k * H_chk;
+      const uint32_t chunk_end = std::min(H, (uint32_t)((k+1) * H_chk));
+      TraceScope chunk_scope(tracer, "chunk", "genhist", 0, "chunk", k);
+      pool->forBlocks(n, block, [&](int tid, int64_t beg, int64_t end) {
+          TraceScope block_scope(tracer, "block", "genhist", tid, "elements", end - beg);
+          BETA* hist = direct ? out : histos + (tid / C) * lay.sub;
+          int32_t* hist_locks = locks ? locks + (tid / C) * lay.sub : NULL;
+          uint16_t* hist_tiles = lazy ? tile_pass.data() + (tid / C) * lay.tiles : NULL;
+          int64_t& hist_touched = touched[tid];
+          RES side = sr.ne();
+          // the pending run, if pre-aggregating
+          uint32_t run_idx = none;
+          BETA run_val = desc.ne();
+          auto apply = [&](uint32_t idx, BETA v) {
+            if (!pre_aggregate) {
+              update(hist, hist_locks, hist_tiles, hist_touched, idx, v);
+            } else if (idx == run_idx) {
+              run_val = desc.opScal(run_val, v);
+            } else {
+              if (run_idx != none) {
+                update(hist, hist_locks, hist_tiles, hist_touched, run_idx, run_val);
+              }
+              run_idx = idx;
+              run_val = v;
+            }
+          };
+          if (batched) {
+            // batches of elements, their (index, value) pairs, and the
+            // pairs of this chunk compacted for the SIMD kernel
+            ALPHA xs[batch_size];
+            uint32_t idx[batch_size];
+            BETA val[batch_size];
+            for (int64_t b0 = beg; b0 < end; b0 += batch_size) {
+              const int len = (int)std::min((int64_t)batch_size, end - b0);
+              for (int j = 0; j < len; j++) {
+                xs[j] = elem(b0 + j);
+              }
+              if (k == 0) {
+                for (int j = 0; j < len; j++) {
+                  side = sr.op(side, sr.map(xs[j]));
+                }
+              }
+              evalBatch(desc, H, xs, len, idx, val);
+              int fill = 0;
+              for (int j = 0; j < len; j++) {
+                if (idx[j] >= chunk_beg && idx[j] < chunk_end) {
+                  idx[fill] = idx[j];
+                  val[fill] = val[j];
+                  fill++;
+                }
+              }
+              if (simd != SIMD_SCALAR) {
+                if (hist_tiles) {
+                  for (int j = 0; j < fill; j++) {
+                    touch(hist, hist_tiles, hist_touched, idx[j]);
+                  }
+                }
+                simdAdd<HP>(simd, hist, idx, val, fill, slots);
+              } else {
+                for (int j = 0; j < fill; j++) {
+                  apply(idx[j], val[j]);
+                }
+              }
+            }
+          } else if (dist == 0) {
+            for (int64_t i = beg; i < end; i++) {
+              const ALPHA x = elem(i);
+              if (k == 0) {
+                side = sr.op(side, sr.map(x));
+              }
+              struct indval<BETA> iv = desc.f(H, x);
+              if (iv.index < chunk_beg || iv.index >= chunk_end) {
+                continue;
+              }
+              apply(iv.index, iv.value);
+            }
+          } else {
+            // the 'dist' most recent updates, whose bins are being
+            // prefetched, in a ring buffer from 'tail' to 'head'
+            struct indval<BETA> ring[prefetch_distance_max];
+            const int64_t mask = dist - 1;
+            int64_t head = 0, tail = 0;
+            for (int64_t i = beg; i < end; i++) {
+              const ALPHA x = elem(i);
+              if (k == 0) {
+                side = sr.op(side, sr.map(x));
+              }
+              struct indval<BETA> iv = desc.f(H, x);
+              if (iv.index < chunk_beg || iv.index >= chunk_end) {
+                continue;
+              }
+              __builtin_prefetch(hist + lay.slot(iv.index), 1);
+              if (hist_locks) {
+                __builtin_prefetch(hist_locks + lay.slot(iv.index), 1);
+              }
+              if (head - tail == dist) {
+                apply(ring[tail & mask].index, ring[tail & mask].value);
+                tail++;
+              }
+              ring[head++ & mask] = iv;
+            }
+            for (; tail < head; tail++) {
+              apply(ring[tail & mask].index, ring[tail & mask].value);
+            }
+          }
+          if (run_idx != none) {
+            update(hist, hist_locks, hist_tiles, hist_touched, run_idx, run_val);
+          }
+          if (k == 0) {
+            partials[tid] = sr.op(partials[tid], side);
+          }
+        });
+    }
+
+    init_bins = 0;
+    for (int tid = 0; tid < T; tid++) {
+      init_bins += touched[tid];
+    }
+    if (!direct && !lazy) {
+      init_bins = lay.bins;
+    }
+    traffic = num_chunks * n * elem_bytes + 2 * ((int64_t)H + init_bins) * (int64_t)sizeof(BETA);
+
+    // reduce across the subhistograms that this pass initialised, tile
+    // by tile, folding into the output
+    if (!direct) {
+      TraceScope scope(tracer, "reduce", "genhist", 0, "subhistograms", M);
+      pool->run([&](int tid) {
+          std::vector<int> live;
+          for (int64_t t = lay.tiles * tid / T; t < lay.tiles * (tid+1) / T; t++) {
+            live.clear();
+            for (int m = 0; m < M; m++) {
+              if (tile_pass[m * lay.tiles + t] == pass) {
+                live.push_back(m);
+              }
+            }
+            if (live.empty()) {
+              continue;
+            }
+            const int64_t end = std::min((int64_t)H, (t+1) << lay.tile_shift);
+            for (int64_t b = t << lay.tile_shift; b < end; b++) {
+              BETA acc = out[b];
+              for (size_t l = 0; l < live.size(); l++) {
+                acc = desc.opScal(acc, histos[live[l] * lay.sub + lay.slot(b)]);
+              }
+              out[b] = acc;
+            }
+          }
+        });
+    }
+
+    RES side = sr.ne();
+    for (int tid = 0; tid < T; tid++) {
+      side = sr.op(side, partials[tid]);
+    }
+    return side;
+  }
+
+  // The prefetch distance for a pass over chunks of H_chk bins: as
+  // configured if positive, otherwise the tuned distance if the active
+  // chunk of the subhistograms exceeds the targeted cache fraction.
+  int choosePrefetch(int32_t H_chk) const {
+    if (consts.prefetch_distance < 0) {
+      return 0;
+    }
+    if (consts.prefetch_distance > 0) {
+      int d = 1;
+      while (d < consts.prefetch_distance && d < prefetch_distance_max) {
+        d *= 2;
+      }
+      return d;
+    }
+    const double active = (double)M * H_chk * sizeof(BETA);
+    return active > consts.L2Fract * consts.LLCache ? tunedPrefetchDistance() : 0;
+  }
+
+  // Initialise the tile of bin 'idx' of the subhistogram starting at
+  // 'hist', if this pass has not yet done so.  'hist_tiles' holds the
+  // pass numbers of its tiles; 'count' is increased by the bins set.
+  inline void touch(BETA* hist, uint16_t* hist_tiles, int64_t& count, uint32_t idx) {
+    uint16_t& t = hist_tiles[idx >> lay.tile_shift];
+    if (t == pass) {
+      return;
+    }
+    t = pass;
+    const uint32_t beg = idx >> lay.tile_shift << lay.tile_shift;
+    const uint32_t end = (uint32_t)std::min((int64_t)H, (int64_t)beg + (1 << lay.tile_shift));
+    for (uint32_t b = beg; b < end; b++) {
+      hist[lay.slot(b)] = desc.ne();
+    }
+    count += end - beg;
+  }
+
+  // Update bin 'idx' of the subhistogram starting at 'hist', whose
+  // tiles are initialised on demand if 'hist_tiles' is given.
+  inline void update(BETA* hist, int32_t* hist_locks, uint16_t* hist_tiles, int64_t& count,
+                     uint32_t idx, BETA v) {
+    if (hist_tiles) {
+      touch(hist, hist_tiles, count, idx);
+    }
+    const int64_t pos = lay.slot(idx);
+    int retries = 0;
+    if (C == 1) {
+      hist[pos] = desc.opScal(hist[pos], v);
+    } else {
+      retries = hostOpAtom<HP>(desc, hist, hist_locks, pos, v);
+    }
+    if (prof) {
+      prof->record(idx, retries);
+    }
+  }
+
+  // Bin b of subhistogram m is at m*sub + slot(b) in the subhistogram
+  // buffer (and the lock buffer), which holds 'bins' elements.  Bins
+  // are initialised in tiles of a cache line, 1 << tile_shift bins,
+  // 'tiles' per subhistogram.
+  struct Layout {
+    int64_t sub, group;
+    int shift;
+    uint32_t mask;
+    int64_t bins;
+    int tile_shift;
+    int64_t tiles;
+    inline int64_t slot(uint32_t b) const {
+      return (int64_t)(b >> shift) * group + (b & mask);
+    }
+  };
+
+  static Layout layoutOf(SubhistoLayout layout, uint32_t H, int M) {
+    // the fewest elements that fill whole cache lines (a power of two)
+    int line = 1;
+    while ((line * sizeof(BETA)) % 64 != 0) {
+      line *= 2;
+    }
+    const int64_t padded = ((int64_t)H + line - 1) / line * line;
+    Layout lay;
+    if (layout == INTERLEAVED) {
+      lay.sub = line;
+      lay.group = (int64_t)M * line;
+      lay.shift = 0;
+      while ((1 << lay.shift) < line) {
+        lay.shift++;
+      }
+      lay.mask = line - 1;
+      lay.bins = M * padded;
+    } else {
+      lay.sub = layout == PADDED ? padded : H;
+      lay.group = 1;
+      lay.shift = 0;
+      lay.mask = 0;
+      lay.bins = M * lay.sub;
+    }
+    lay.tile_shift = 0;
+    while ((1 << lay.tile_shift) < line) {
+      lay.tile_shift++;
+    }
+    lay.tiles = ((int64_t)H + (1 << lay.tile_shift) - 1) >> lay.tile_shift;
+    return lay;
+  }
+
+  // Bytes of memory used by an engine with M subhistograms of H bins
+  // shared by T threads: the subhistograms, their locks (if needed) and
+  // tile pass numbers, and the result.  The subhistograms and locks are
+  // mapped with 'pages' (see pageAllocBytes).
+  static size_t footprint(const HP& desc, uint32_t H, int M, int T, SubhistoLayout layout,
+                          PagePolicy pages) {
+    const int C = (T + M - 1) / M;
+    const bool locks = desc.atomicKind() == XCG && C > 1;
+    const Layout lay = layoutOf(layout, H, M);
+    return pageAllocBytes((size_t)lay.bins * sizeof(BETA), pages) +
+      (locks ? pageAllocBytes((size_t)lay.bins * sizeof(int32_t), pages) : 0) +
+      (size_t)M * lay.tiles * sizeof(uint16_t) + (size_t)H * sizeof(BETA);
+  }
+
+  // Port of the GlobalMemoryGenHist cost model, with the last-level
+  // cache in place of the GPU L2 and M capped at T (a subhistogram
+  // per thread already removes all atomics).  'topo' tells whether
+  // thread ids follow CpuTopology::system().
+  static void plan(const HostGenHistConfig& consts, const HP& desc, int T, bool topo, int RF,
+                   uint32_t H, int64_t N, int& M, int& C, int& num_chunks) {
+    const AtomicPrim prim_kind = desc.atomicKind();
+    const int   avg_size= (prim_kind == XCG)? ( sizeof(BETA) + sizeof(int) )/2 : sizeof(BETA);
+    const int   el_size = (prim_kind == XCG)? sizeof(BETA) + sizeof(int) : sizeof(BETA);
+    const float optim_k_min = consts.glb_k_min;
+    const int   q_small = 2;
+    const int64_t work_asymp_M_max = std::max((int64_t)1, N / ((int64_t)q_small*H));
+
+    // first part
+    float race_exp = std::max(1.0, (1.0 * consts.k_RF * RF) / ( (4.0*consts.CLelmsz) / avg_size) );
+    float coop_min = std::min( (float)T, H/optim_k_min );
+    const int Mdeg = (int)std::min(work_asymp_M_max, (int64_t)std::max(1, (int) (T / coop_min)));
+    const double S_nom = (double)Mdeg*H*avg_size;
+    const double S_den = consts.L2Fract * consts.LLCache * race_exp;
+    num_chunks = std::max(1, (int)ceil(S_nom / S_den));
+    const int H_chk = (H + num_chunks - 1) / num_chunks;
+
+    // second part
+    const float u = (prim_kind == HDW) ? 2.0 : 1.0;
+    const float k_max= std::min( consts.L2Fract * ( (1.0F*consts.LLCache) / el_size ) * race_exp, (float)N ) / T;
+    const float coop = std::min( (float)T, (u * H_chk) / k_max );
+    M = std::max( 1, (int)floor(T/coop) );
+    M = (int)std::min((int64_t)std::min(M, T), work_asymp_M_max);
+
+    // cooperation along the cache hierarchy, in groups of Ct threads
+    int Ct = 0;
+    if (consts.topology_coop && topo && T > 1) {
+      const CpuTopology& cpu = CpuTopology::system();
+      const double l2  = consts.L2Fract * cpu.l2_bytes * race_exp;
+      const double llc = consts.L2Fract * (cpu.llc_bytes ? cpu.llc_bytes : consts.LLCache) * race_exp;
+      const double sub = (double)H_chk * avg_size;
+      const int levels[4] = { 1, cpu.smt_threads, cpu.l2_threads, cpu.llc_threads };
+      Ct = std::max(1, cpu.llc_threads);
+      for (int l = 0; l < 4; l++) {
+        const int c = std::max(1, levels[l]);
+        // an L2 too small for even one subhistogram does not constrain C
+        const bool l2_fits = cpu.l2_bytes == 0 || sub > l2 ||
+          ceil((double)std::min(T, cpu.l2_threads) / c) * sub <= l2;
+        const bool llc_fits = ceil((double)std::min(T, cpu.llc_threads) / c) * sub <= llc;
+        if (l2_fits && llc_fits) {
+          Ct = c;
+          break;
+        }
+      }
+      Ct = std::min(Ct, T);
+      M = (int)std::min((int64_t)((T + Ct - 1) / Ct), work_asymp_M_max);
+    }
+
+    // fewer subhistograms (hence more cooperation) to fit the budget
+    if (consts.mem_budget > 0 && footprint(desc, H, M, T, consts.layout, consts.pages) > consts.mem_budget) {
+      const Layout one = layoutOf(consts.layout, H, 1);
+      const size_t per_sub = (size_t)one.bins * el_size + (size_t)one.tiles * sizeof(uint16_t);
+      const size_t result = (size_t)H * sizeof(BETA);
+      if (consts.mem_budget >= result + per_sub) {
+        M = std::max(1, std::min(M, (int)((consts.mem_budget - result) / per_sub)));
+      }
+      // rounding to huge pages may take a few more
+      while (M > 1 && footprint(desc, H, M, T, consts.layout, consts.pages) > consts.mem_budget) {
+        M--;
+      }
+      if (footprint(desc, H, M, T, consts.layout, consts.pages) > consts.mem_budget) {
+        throw std::runtime_error("HostGenHist: memory budget is too small for a single subhistogram");
+      }
+    }
+
+    C = (T + M - 1) / M;
+    if (Ct > 0 && (T + Ct - 1) / Ct == M) {
+      C = Ct; // keep groups aligned to their domains
+    }
+  }
+
+  static void* alignedAlloc(size_t bytes) {
+    void* p;
+    if (posix_memalign(&p, 64, std::max(bytes, (size_t)64)) != 0) {
+      throw std::bad_alloc();
+    }
+    return p;
+  }
+
+  const HostGenHistConfig consts;
+  const HP desc;
+  WorkerPool* pool;
+  std::unique_ptr<WorkerPool> owned_pool;
+  int RF, T, M, C, num_chunks;
+  float run_length;
+  int prefetch_dist;
+  SimdLevel simd;
+  Layout lay;
+  uint32_t H;
+  int64_t N;
+  std::vector<uint16_t> tile_pass; // M*lay.tiles
+  uint16_t pass;
+  bool lazy;
+  int64_t init_bins;
+  int64_t traffic;
+  BinProfile* prof;
+  Tracer* tracer;
+  std::vector<std::unique_ptr<PerfGroup> > perf; // one per thread, if counting
+  PerfSample perf_sample;
+  std::string perf_error;
+  std::thread::id perf_caller; // the thread that perf[0] counts
+  PageBuffer histos_buf, locks_buf;
+  BETA* histos;
+  BETA* histo;
+  int32_t* locks;
+};
+
+}
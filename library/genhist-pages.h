@@ -0,0 +1,200 @@
+// Page-size policies for large buffers of the CPU libraries.
+//
+// Histogram updates are random accesses, so subhistograms of hundreds
+// of megabytes backed by 4 KiB pages miss in the TLB on almost every
+// update.  pageAlloc backs a buffer with huge pages when asked to:
+//
+// * EXPLICIT_HUGE maps the buffer with MAP_HUGETLB, from the pool that
+//   the administrator reserved in /proc/sys/vm/nr_hugepages.
+//
+// * TRANSPARENT_HUGE allocates a buffer aligned to the huge page size
+//   and marks it with madvise(MADV_HUGEPAGE), so that the kernel backs
+//   it with transparent huge pages when it can.  That only requests
+//   them: the pages are allocated when first touched, and may then be
+//   small ones.  hugePageBytes tells how much of a buffer is huge.
+//
+// * SMALL_PAGES is a plain page-aligned allocation.
+//
+// A request that cannot be satisfied falls back to the next weaker
+// policy, and the returned PageBuffer records the policy that took
+// effect.  Buffers smaller than a huge page always use small pages.
+// Huge-page buffers are rounded up to a whole number of huge pages;
+// pageAllocBytes tells how many bytes a request maps.
+//
+// Only the buffers that the libraries allocate themselves (the
+// subhistograms, their locks, and the block buffers of
+// genhist-stream.h) follow the policy; inputs and results passed in by
+// the caller keep whatever pages they were allocated with.
+
+#pragma once
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+namespace genhist {
+
+enum PagePolicy {SMALL_PAGES, TRANSPARENT_HUGE, EXPLICIT_HUGE};
+
+inline const char* pagePolicyName(PagePolicy p) {
+  return p == EXPLICIT_HUGE ? "explicit huge pages" :
+    p == TRANSPARENT_HUGE ? "transparent huge pages (requested)" : "small pages";
+}
+
+struct PageBuffer {
+  void* ptr;
+  size_t bytes;      // allocated size
+  PagePolicy policy; // the policy that took effect (for TRANSPARENT_HUGE, was accepted)
+};
+
+// The default huge page size, from /proc/meminfo (2 MiB if unknown).
+inline size_t hugePageSize() {
+  static const size_t size = [] {
+    size_t kb = 2048;
+    FILE* f = fopen("/proc/meminfo", "r");
+    if (f) {
+      char line[128];
+      while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "Hugepagesize: %zu kB", &kb) == 1) {
+          break;
+        }
+      }
+      fclose(f);
+    }
+    return kb * 1024;
+  }();
+  return size;
+}
+
+// Whether transparent huge pages may be used for madvise()d memory.
+inline bool transparentHugePagesEnabled() {
+  static const bool enabled = [] {
+    char mode[128] = "";
+    FILE* f = fopen("/sys/kernel/mm/transparent_hugepage/enabled", "r");
+    if (!f) {
+      return false;
+    }
+    const bool ok = fgets(mode, sizeof(mode), f) != NULL;
+    fclose(f);
+    return ok && strstr(mode, "[never]") == NULL;
+  }();
+  return enabled;
+}
+
+// The bytes that pageAlloc(bytes, want) maps, assuming that explicit
+// huge pages are available when asked for (a fallback to small pages
+// maps fewer).
+inline size_t pageAllocBytes(size_t bytes, PagePolicy want) {
+  bytes = std::max(bytes, (size_t)64);
+  const size_t huge = hugePageSize();
+#ifdef __linux__
+  if (bytes >= huge && (want == EXPLICIT_HUGE ||
+                        (want == TRANSPARENT_HUGE && transparentHugePagesEnabled()))) {
+    return (bytes + huge - 1) / huge * huge;
+  }
+#endif
+  return bytes;
+}
+
+inline PageBuffer pageAlloc(size_t bytes, PagePolicy want) {
+  PageBuffer buf;
+  bytes = std::max(bytes, (size_t)64);
+  const size_t huge = hugePageSize();
+  if (bytes < huge) {
+    want = SMALL_PAGES;
+  }
+#ifdef __linux__
+  if (want == EXPLICIT_HUGE) {
+    const size_t len = pageAllocBytes(bytes, EXPLICIT_HUGE);
+    void* p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p != MAP_FAILED) {
+      buf.ptr = p;
+      buf.bytes = len;
+      buf.policy = EXPLICIT_HUGE;
+      return buf;
+    }
+    want = TRANSPARENT_HUGE;
+  }
+  if (want == TRANSPARENT_HUGE && transparentHugePagesEnabled()) {
+    const size_t len = pageAllocBytes(bytes, TRANSPARENT_HUGE);
+    if (posix_memalign(&buf.ptr, huge, len) != 0) {
+      throw std::bad_alloc();
+    }
+    buf.bytes = len;
+    buf.policy = madvise(buf.ptr, len, MADV_HUGEPAGE) == 0 ? TRANSPARENT_HUGE : SMALL_PAGES;
+    return buf;
+  }
+#endif
+  const size_t page = sysconf(_SC_PAGESIZE);
+  if (posix_memalign(&buf.ptr, bytes >= page ? page : 64, bytes) != 0) {
+    throw std::bad_alloc();
+  }
+  buf.bytes = bytes;
+  buf.policy = SMALL_PAGES;
+  return buf;
+}
+
+// Bytes of 'buf' that are currently backed by huge pages: all of an
+// EXPLICIT_HUGE buffer, and for TRANSPARENT_HUGE an estimate from the
+// AnonHugePages of the mappings that the buffer overlaps in
+// /proc/self/smaps (zero if that cannot be read).  smaps does not say
+// where in a mapping its huge pages are, so each mapping contributes
+// in proportion to the part of it that the buffer covers; this is
+// exact when the buffer has a mapping of its own, as large allocations
+// usually do.  Only meaningful once the buffer was touched.
+inline size_t hugePageBytes(const PageBuffer& buf) {
+  if (buf.ptr == NULL || buf.policy == SMALL_PAGES) {
+    return 0;
+  }
+  if (buf.policy == EXPLICIT_HUGE) {
+    return buf.bytes;
+  }
+  double huge = 0;
+#ifdef __linux__
+  FILE* f = fopen("/proc/self/smaps", "r");
+  if (!f) {
+    return 0;
+  }
+  const unsigned long beg = (unsigned long)buf.ptr, end = beg + buf.bytes;
+  double covered = 0; // fraction of the current mapping inside 'buf'
+  char line[1024];
+  while (fgets(line, sizeof(line), f)) {
+    unsigned long lo, hi;
+    size_t kb;
+    if (sscanf(line, "%lx-%lx ", &lo, &hi) == 2) {
+      const unsigned long olo = std::max(lo, beg), ohi = std::min(hi, end);
+      covered = olo < ohi ? (double)(ohi - olo) / (hi - lo) : 0;
+    } else if (covered > 0 && sscanf(line, "AnonHugePages: %zu kB", &kb) == 1) {
+      huge += covered * kb * 1024;
+    }
+  }
+  fclose(f);
+#endif
+  return std::min((size_t)(huge + 0.5), buf.bytes);
+}
+
+inline void pageFree(PageBuffer& buf) {
+  if (buf.ptr == NULL) {
+    return;
+  }
+#ifdef __linux__
+  if (buf.policy == EXPLICIT_HUGE) {
+    munmap(buf.ptr, buf.bytes);
+    buf.ptr = NULL;
+    return;
+  }
+#endif
+  free(buf.ptr);
+  buf.ptr = NULL;
+}
+
+}
@@ -0,0 +1,241 @@
+// Hardware performance counters around histogram passes (Linux).
+//
+// To check the cache assumptions of the cost model (L2Fract, CLelmsz,
+// the cache size) against what the hardware does, a PerfGroup counts
+// the cycles, instructions, last-level cache misses, data TLB misses
+// and branch misses of one thread with perf_event_open, in user space
+// only (so perf_event_paranoid up to 2 permits it).  The counters of a
+// group are scheduled together; if the kernel multiplexes them with
+// other events, the counts are scaled up to the time they were enabled.
+//
+// HostGenHist opens a group on each of its threads with
+// setCounters(true), and then reports the sums over all threads for
+// every pass (see 'counters').  A group counts only the thread that
+// opened it, so the engine reopens the group of tid 0 when a pass is
+// run by another thread than the one that called setCounters.
+// Counters that the kernel or the CPU refuse (in containers, virtual
+// machines, or with a stricter perf_event_paranoid) read as -1, and if
+// none can be opened 'available' is false and 'error' says why; the
+// passes themselves are unaffected.
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace genhist {
+
+enum PerfCounter {PERF_CYCLES, PERF_INSTRUCTIONS, PERF_LLC_MISSES, PERF_DTLB_MISSES,
+                  PERF_BRANCH_MISSES, PERF_NUM_COUNTERS};
+
+inline const char* perfCounterName(PerfCounter c) {
+  static const char* const names[PERF_NUM_COUNTERS] =
+    { "cycles", "instructions", "LLC misses", "dTLB misses", "branch misses" };
+  return names[c];
+}
+
+// Counts of one or more threads; -1 for counters that are unavailable.
+struct PerfSample
+{
+  int64_t count[PERF_NUM_COUNTERS];
+
+  PerfSample() {
+    for (int c = 0; c < PERF_NUM_COUNTERS; c++) {
+      count[c] = -1;
+    }
+  }
+
+  int64_t operator[](PerfCounter c) const { return count[c]; }
+
+  // Add the available counts of 'o'.
+  void add(const PerfSample& o) {
+    for (int c = 0; c < PERF_NUM_COUNTERS; c++) {
+      if (o.count[c] >= 0) {
+        count[c] = (count[c] < 0 ? 0 : count[c]) + o.count[c];
+      }
+    }
+  }
+
+  // Instructions per cycle; zero if unavailable.
+  double ipc() const {
+    return count[PERF_CYCLES] > 0 && count[PERF_INSTRUCTIONS] >= 0 ?
+      (double)count[PERF_INSTRUCTIONS] / count[PERF_CYCLES] : 0;
+  }
+};
+
+// The counters of the thread that opens it.
+class PerfGroup
+{
+public:
+  PerfGroup() : leader(-1) {
+    for (int c = 0; c < PERF_NUM_COUNTERS; c++) {
+      fds[c] = -1;
+    }
+  }
+
+  ~PerfGroup() { close(); }
+
+  PerfGroup(const PerfGroup&) = delete;
+  PerfGroup& operator=(const PerfGroup&) = delete;
+
+  // Open the counters for the calling thread, disabled.  Returns
+  // whether at least one could be opened; see 'error' otherwise.
+  bool open() {
+    close();
+#ifdef __linux__
+    const uint32_t types[PERF_NUM_COUNTERS] =
+      { PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE, PERF_TYPE_HW_CACHE,
+        PERF_TYPE_HARDWARE };
+    const uint64_t configs[PERF_NUM_COUNTERS] =
+      { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+          (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+        PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+          (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+        PERF_COUNT_HW_BRANCH_MISSES };
+    for (int c = 0; c < PERF_NUM_COUNTERS; c++) {
+      struct perf_event_attr attr;
+      memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = types[c];
+      attr.config = configs[c];
+      attr.disabled = leader < 0;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_ID |
+        PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+      fds[c] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+      if (fds[c] < 0) {
+        if (err.empty()) {
+          err = std::string("perf_event_open: ") + strerror(errno);
+        }
+        continue;
+      }
+      ioctl(fds[c], PERF_EVENT_IOC_ID, &ids[c]);
+      if (leader < 0) {
+        leader = fds[c];
+      }
+    }
+    if (leader >= 0) {
+      err.clear();
+    }
+#else
+    err = "hardware counters need Linux";
+#endif
+    return leader >= 0;
+  }
+
+  void close() {
+#ifdef __linux__
+    for (int c = 0; c < PERF_NUM_COUNTERS; c++) {
+      if (fds[c] >= 0) {
+        ::close(fds[c]);
+      }
+      fds[c] = -1;
+    }
+#endif
+    leader = -1;
+  }
+
+  bool available() const { return leader >= 0; }
+  const std::string& error() const { return err; }
+
+  // Reset and enable the group, and disable it; these may be called
+  // from any thread.
+  void start() {
+#ifdef __linux__
+    if (leader >= 0) {
+      ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+      ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+#endif
+  }
+
+  void stop() {
+#ifdef __linux__
+    if (leader >= 0) {
+      ioctl(leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    }
+#endif
+  }
+
+  // The counts since the last start, scaled for multiplexing.
+  PerfSample read() const {
+    PerfSample s;
+#ifdef __linux__
+    if (leader < 0) {
+      return s;
+    }
+    // nr, time_enabled, time_running, then a value and id per counter
+    uint64_t buf[3 + 2 * PERF_NUM_COUNTERS];
+    if (::read(leader, buf, sizeof(buf)) < (ssize_t)(3 * sizeof(uint64_t))) {
+      return s;
+    }
+    const uint64_t nr = buf[0], enabled = buf[1], running = buf[2];
+    if (running == 0) {
+      return s; // never scheduled: the counts are unknown, not zero
+    }
+    const double scale = (double)enabled / running;
+    for (uint64_t i = 0; i < nr && i < PERF_NUM_COUNTERS; i++) {
+      for (int c = 0; c < PERF_NUM_COUNTERS; c++) {
+        if (fds[c] >= 0 && ids[c] == buf[4 + 2*i]) {
+          s.count[c] = (int64_t)(buf[3 + 2*i] * scale + 0.5);
+        }
+      }
+    }
+#endif
+    return s;
+  }
+
+private:
+  int fds[PERF_NUM_COUNTERS];
+  uint64_t ids[PERF_NUM_COUNTERS];
+  int leader;
+  std::string err;
+};
+
+// Counts the lifetime of a scope on all of 'groups' and stores the sum
+// in 'out'; does nothing if 'groups' is empty.
+class PerfScope
+{
+public:
+  PerfScope(const std::vector<std::unique_ptr<PerfGroup> >& groups, PerfSample& out)
+    : groups(groups), out(out) {
+    for (size_t i = 0; i < groups.size(); i++) {
+      groups[i]->start();
+    }
+  }
+
+  ~PerfScope() {
+    if (groups.empty()) {
+      return;
+    }
+    for (size_t i = 0; i < groups.size(); i++) {
+      groups[i]->stop();
+    }
+    out = PerfSample();
+    for (size_t i = 0; i < groups.size(); i++) {
+      out.add(groups[i]->read());
+    }
+  }
+
+  PerfScope(const PerfScope&) = delete;
+  PerfScope& operator=(const PerfScope&) = delete;
+
+private:
+  const std::vector<std::unique_ptr<PerfGroup> >& groups;
+  PerfSample& out;
+};
+
+}
@@ -0,0 +1,150 @@
+// Inspector/executor histograms for index patterns that repeat.
+//
+// Many applications compute reduce_by_index with the same index array
+// over and over while only the values change: the neighbour lists of
+// a molecular dynamics code hold for many time steps, and cluster
+// memberships in k-means change little between iterations.  Every
+// call to HostGenHist rediscovers the same conflicts.  HistPlan instead
+// inspects the index array once and records
+//
+// * a conflict-free ordering: the element positions grouped by bin
+//   (stably, so the elements of a bin keep their relative order),
+//
+// * the segments of that ordering, one per non-empty bin, and
+//
+// * the ownership of segments by threads, balanced by element count.
+//
+// Each call to exec(values) then reduces every segment sequentially in
+// the thread that owns it and writes the bin directly: no atomics, no
+// subhistograms and no final merge.  The plan costs about one
+// sequential pass plus a counting sort over the indices, which is
+// recovered after a few executions.
+//
+// The descriptor only needs to provide BETA, 'ne' and 'opScal'; any
+// HistDescriptor works.  As in Futhark's reduce_by_index, indices that
+// are out of bounds are ignored.
+
+#pragma once
+
+#include "genhist-common.h"
+#include "genhist-pool.h"
+
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+namespace genhist {
+
+template<class HP>
+class HistPlan
+{
+public:
+  typedef typename HP::BETA BETA;
+
+  // Inspect the 'n' indices into a histogram of H bins.  The plan
+  // keeps no reference to 'indices'.  Executions run on 'pool' if
+  // given (see genhist-pool.h).
+  HistPlan(int H, const uint32_t* indices, int64_t n, int num_threads = 0, HP desc = HP(),
+           WorkerPool* pool = NULL)
+    : desc(desc), H(H), n(n) {
+    if (H <= 0 || n < 0) {
+      throw std::invalid_argument("HistPlan: need H > 0 and n >= 0");
+    }
+    this->pool = selectPool(pool, num_threads, owned_pool);
+    T = this->pool->numThreads();
+
+    // counting sort of the element positions by bin
+    std::vector<int64_t> count(H + 1, 0);
+    for (int64_t i = 0; i < n; i++) {
+      if (indices[i] < (uint32_t)H) {
+        count[indices[i] + 1]++;
+      }
+    }
+    for (int b = 0; b < H; b++) {
+      if (count[b + 1] > 0) {
+        seg_bin.push_back(b);
+        seg_start.push_back(count[b]);
+      }
+      count[b + 1] += count[b];
+    }
+    seg_start.push_back(count[H]);
+    order.resize(count[H]);
+    for (int64_t i = 0; i < n; i++) {
+      if (indices[i] < (uint32_t)H) {
+        order[count[indices[i]]++] = i;
+      }
+    }
+
+    // thread t owns segments [owner[t], owner[t+1]), where owner[t] is
+    // the first segment that starts at or after element order.size()*t/T
+    const int64_t S = seg_bin.size();
+    owner.resize(T + 1);
+    int64_t s = 0;
+    for (int t = 0; t <= T; t++) {
+      const int64_t target = (int64_t)order.size() * t / T;
+      while (s < S && seg_start[s] < target) {
+        s++;
+      }
+      owner[t] = s;
+    }
+    owner[T] = S;
+
+    histo.assign(H, desc.ne());
+  }
+
+  // Compute the histogram of values[0..n-1], with element i going to
+  // the bin given by indices[i] at construction.
+  void exec(const BETA* values) {
+    run(values, true);
+  }
+
+  // As above, but fold into the current result instead of replacing it.
+  void accumulate(const BETA* values) {
+    run(values, false);
+  }
+
+  const BETA* result() const { return histo.data(); }
+
+  int numThreads() const { return T; }
+  int64_t numElems() const { return n; }
+  int64_t numSegments() const { return seg_bin.size(); }
+
+private:
+  void run(const BETA* values, bool fresh) {
+    pool->run([&](int t) { work(t, values, fresh); });
+  }
+
+  void work(int t, const BETA* values, bool fresh) {
+    if (fresh) {
+      // empty bins are reset by the thread owning the preceding segment
+      const int bin_beg = t == 0 ? 0 : firstBin(owner[t]);
+      std::fill(histo.begin() + bin_beg, histo.begin() + firstBin(owner[t+1]), desc.ne());
+    }
+    for (int64_t s = owner[t]; s < owner[t+1]; s++) {
+      BETA acc = fresh ? desc.ne() : histo[seg_bin[s]];
+      for (int64_t j = seg_start[s]; j < seg_start[s+1]; j++) {
+        acc = desc.opScal(acc, values[order[j]]);
+      }
+      histo[seg_bin[s]] = acc;
+    }
+  }
+
+  int firstBin(int64_t s) const {
+    return s < (int64_t)seg_bin.size() ? seg_bin[s] : H;
+  }
+
+  const HP desc;
+  const int H;
+  const int64_t n;
+  WorkerPool* pool;
+  std::unique_ptr<WorkerPool> owned_pool;
+  int T;
+  std::vector<int64_t> order;     // element positions grouped by bin
+  std::vector<int> seg_bin;       // bin of each segment
+  std::vector<int64_t> seg_start; // start of each segment in 'order'
+  std::vector<int64_t> owner;     // first segment of each thread
+  std::vector<BETA> histo;
+};
+
+}
@@ -0,0 +1,276 @@
+// A persistent pool of worker threads for the CPU libraries.
+//
+// Creating and joining threads costs tens of microseconds per thread,
+// which dominates histograms of small inputs and repeated calls.  A
+// WorkerPool starts its threads once, optionally pins each to a core
+// (in the order of CpuTopology, so that threads with nearby ids share
+// caches, with the calling thread on the first core while it takes
+// part in a task), and hands them one task at a time:
+//
+// * run(fn) calls fn(tid) for every tid in [0, numThreads()), where
+//   tid 0 is the calling thread, and returns when all calls have
+//   finished.
+//
+// * forBlocks(n, block, fn) splits [0, n) into one contiguous range
+//   per thread, and calls fn(tid, beg, end) for blocks of at most
+//   'block' indices.  Each thread first takes blocks from its own
+//   range, in increasing order, and then steals the remaining blocks
+//   of the other threads, so a thread that is delayed (or shares its
+//   core) does not hold up the others.
+//
+// Between tasks, workers spin for a short while before they block, so
+// that a sequence of calls does not pay for waking them up.  Tasks
+// must not throw, and must not submit work to the pool they run on.
+// Calls from several threads are serialised.
+//
+// The library engines use defaultPool() unless they are given a pool
+// or a thread count that differs from it.
+
+#pragma once
+
+#include "genhist-topology.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace genhist {
+
+class WorkerPool
+{
+public:
+  // A pool of 'num_threads' threads, counting the caller; zero means
+  // std::thread::hardware_concurrency().  With 'pin', worker i is
+  // bound to the i-th CPU of CpuTopology::system(), and the calling
+  // thread (tid 0) to the first one during each task, after which its
+  // own affinity is restored.
+  explicit WorkerPool(int num_threads = 0, bool pin = true)
+    : pin(pin), caller_cpu(-1), generation(0), pending(0), stop(false), task_call(NULL),
+      task_ctx(NULL) {
+    T = num_threads > 0 ? num_threads :
+      std::max(1, (int)std::thread::hardware_concurrency());
+    cursors.reset(new Cursor[T]);
+    std::vector<int> cpus;
+    if (pin) {
+      const CpuTopology& topo = CpuTopology::system();
+      for (size_t i = 0; i < topo.cpus.size(); i++) {
+        cpus.push_back(topo.cpus[i].id);
+      }
+    }
+    if (!cpus.empty()) {
+      caller_cpu = cpus[0];
+    }
+    for (int tid = 1; tid < T; tid++) {
+      const int cpu = cpus.empty() ? -1 : cpus[tid % cpus.size()];
+      workers.push_back(std::thread(&WorkerPool::loop, this, tid, cpu));
+    }
+  }
+
+  ~WorkerPool() {
+    {
+      std::lock_guard<std::mutex> lk(wake_lock);
+      stop.store(true, std::memory_order_release);
+      generation++;
+    }
+    wake.notify_all();
+    for (size_t i = 0; i < workers.size(); i++) {
+      workers[i].join();
+    }
+  }
+
+  WorkerPool(const WorkerPool&) = delete;
+  WorkerPool& operator=(const WorkerPool&) = delete;
+
+  int numThreads() const { return T; }
+
+  // Whether thread ids follow CpuTopology::system(): the workers are
+  // pinned and there is at most one thread per CPU.
+  bool followsTopology() const {
+    return followsTopology(T, pin);
+  }
+
+  // Whether they would in a pool constructed with these arguments.
+  static bool followsTopology(int num_threads, bool pin) {
+    return pin && num_threads <= (int)CpuTopology::system().cpus.size();
+  }
+
+  template<class F>
+  void run(F fn) {
+    std::lock_guard<std::mutex> guard(run_lock);
+    dispatch(fn);
+  }
+
+  template<class F>
+  void forBlocks(int64_t n, int64_t block, F fn) {
+    std::lock_guard<std::mutex> guard(run_lock);
+    block = std::max((int64_t)1, block);
+    for (int t = 0; t < T; t++) {
+      cursors[t].next.store(n * t / T, std::memory_order_relaxed);
+      cursors[t].end = n * (t+1) / T;
+    }
+    auto steal = [&](int tid) {
+      for (int v = 0; v < T; v++) {
+        Cursor& c = cursors[(tid + v) % T];
+        for (;;) {
+          const int64_t beg = c.next.fetch_add(block, std::memory_order_relaxed);
+          if (beg >= c.end) {
+            break;
+          }
+          fn(tid, beg, std::min(beg + block, c.end));
+        }
+      }
+    };
+    dispatch(steal);
+  }
+
+  // A process-wide pool with one thread per hardware thread.
+  static WorkerPool& defaultPool() {
+    static WorkerPool pool;
+    return pool;
+  }
+
+private:
+  // padded to a cache line, as every thread updates its own
+  struct Cursor {
+    std::atomic<int64_t> next;
+    int64_t end;
+    char pad[64 - sizeof(std::atomic<int64_t>) - sizeof(int64_t)];
+  };
+
+  template<class F>
+  static void invoke(void* ctx, int tid) {
+    (*(F*)ctx)(tid);
+  }
+
+  // Binds the calling thread to 'cpu' (unless it is negative or not
+  // allowed) for the lifetime of the object, and then restores the
+  // thread's previous affinity.
+  class CallerPin
+  {
+  public:
+    explicit CallerPin(int cpu) : pinned(false) {
+#ifdef __linux__
+      if (cpu >= 0 && pthread_getaffinity_np(pthread_self(), sizeof(saved), &saved) == 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        pinned = pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+      }
+#else
+      (void)cpu;
+#endif
+    }
+
+    ~CallerPin() {
+#ifdef __linux__
+      if (pinned) {
+        pthread_setaffinity_np(pthread_self(), sizeof(saved), &saved);
+      }
+#endif
+    }
+
+  private:
+#ifdef __linux__
+    cpu_set_t saved;
+#endif
+    bool pinned;
+  };
+
+  template<class F>
+  void dispatch(F& fn) {
+    if (T == 1) {
+      fn(0);
+      return;
+    }
+    // tid 0 shares caches with tids 1, 2, ... only on the first CPU
+    CallerPin caller(caller_cpu);
+    task_call = &invoke<F>;
+    task_ctx = &fn;
+    pending.store(T - 1, std::memory_order_relaxed);
+    {
+      std::lock_guard<std::mutex> lk(wake_lock);
+      generation.fetch_add(1, std::memory_order_release);
+    }
+    wake.notify_all();
+    fn(0);
+    for (int spins = 0; pending.load(std::memory_order_acquire) != 0; spins++) {
+      if (spins >= spin_limit) {
+        std::this_thread::yield();
+      }
+    }
+  }
+
+  void loop(int tid, int cpu) {
+#ifdef __linux__
+    if (cpu >= 0) {
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      CPU_SET(cpu, &set);
+      pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+#else
+    (void)cpu;
+#endif
+    uint64_t seen = 0;
+    for (;;) {
+      uint64_t g = generation.load(std::memory_order_acquire);
+      for (int spins = 0; g == seen && spins < spin_limit; spins++) {
+        g = generation.load(std::memory_order_acquire);
+      }
+      if (g == seen) {
+        std::unique_lock<std::mutex> lk(wake_lock);
+        wake.wait(lk, [&] { return generation.load(std::memory_order_acquire) != seen; });
+        g = generation.load(std::memory_order_acquire);
+      }
+      seen = g;
+      if (stop.load(std::memory_order_acquire)) {
+        return;
+      }
+      task_call(task_ctx, tid);
+      pending.fetch_sub(1, std::memory_order_release);
+    }
+  }
+
+  // iterations of busy waiting before blocking or yielding
+  static const int spin_limit = 20000;
+
+  int T;
+  const bool pin;
+  int caller_cpu; // the CPU of tid 0 during tasks, or -1
+  std::vector<std::thread> workers;
+  std::unique_ptr<Cursor[]> cursors;
+  std::mutex run_lock, wake_lock;
+  std::condition_variable wake;
+  std::atomic<uint64_t> generation;
+  std::atomic<int> pending;
+  std::atomic<bool> stop;
+  void (*task_call)(void*, int);
+  void* task_ctx;
+};
+
+// The pool an engine should run on: 'pool' if given, otherwise the
+// default pool if 'num_threads' is zero or matches it, and otherwise a
+// new pool that is stored in 'owned'.
+inline WorkerPool*
+selectPool(WorkerPool* pool, int num_threads, std::unique_ptr<WorkerPool>& owned) {
+  if (pool) {
+    return pool;
+  }
+  if (num_threads <= 0 || num_threads == WorkerPool::defaultPool().numThreads()) {
+    return &WorkerPool::defaultPool();
+  }
+  owned.reset(new WorkerPool(num_threads));
+  return owned.get();
+}
+
+}
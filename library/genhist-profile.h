@@ -0,0 +1,144 @@
+// Per-bin contention profiles.
+//
+// A BinProfile counts, for every bin of a histogram, the updates that
+// reached it and how many extra attempts they needed because other
+// threads updated the same bin at the same time: failed
+// compare-and-swaps for the HDW and CAS kinds, failed lock
+// acquisitions for XCG.  HostGenHist fills one during its passes when
+// given one with setProfile (runs that are pre-aggregated count as one
+// update); 'ofInput' counts the updates of the sequential reference,
+// which has no retries.
+//
+// Profiles are exported as CSV (one 'bin,updates,retries' line per
+// bin that was updated) or, compactly, as a Futhark binary data file
+// holding the two [H]u64 arrays (see futhark-data.h), which 'read'
+// loads back and Futhark programs can consume directly.
+//
+// 'raceFactor' turns a profile into the RF argument of the cost model
+// (HostGenHist, LocalMemoryGenHist and GlobalMemoryGenHist): the
+// updates are as contended as if they were spread evenly over H/RF
+// bins, i.e. RF = H * sum(u^2) / sum(u)^2 for the update counts u.
+
+#pragma once
+
+#include "futhark-data.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <errno.h>
+
+namespace genhist {
+
+struct BinProfile
+{
+  std::vector<uint64_t> updates;
+  std::vector<uint64_t> retries;
+
+  BinProfile() { }
+  explicit BinProfile(int32_t H) : updates(H, 0), retries(H, 0) { }
+
+  int32_t numBins() const { return (int32_t)updates.size(); }
+
+  void clear() {
+    std::fill(updates.begin(), updates.end(), 0);
+    std::fill(retries.begin(), retries.end(), 0);
+  }
+
+  // Count an update of 'bin' that took 'r' retries; safe to call
+  // concurrently.
+  inline void record(uint32_t bin, int r) {
+    __atomic_fetch_add(&updates[bin], 1, __ATOMIC_RELAXED);
+    if (r > 0) {
+      __atomic_fetch_add(&retries[bin], (uint64_t)r, __ATOMIC_RELAXED);
+    }
+  }
+
+  uint64_t totalUpdates() const { return sum(updates); }
+  uint64_t totalRetries() const { return sum(retries); }
+
+  // The bin with the most updates.
+  int32_t hottest() const {
+    return (int32_t)(std::max_element(updates.begin(), updates.end()) - updates.begin());
+  }
+
+  // The race factor of the profile, between 1 and H.
+  int raceFactor() const {
+    double s = 0, s2 = 0;
+    for (size_t b = 0; b < updates.size(); b++) {
+      s  += (double)updates[b];
+      s2 += (double)updates[b] * updates[b];
+    }
+    if (s == 0) {
+      return 1;
+    }
+    const double rf = updates.size() * s2 / (s * s);
+    return (int)std::max(1.0, std::min((double)updates.size(), std::round(rf)));
+  }
+
+  // The updates that the sequential reference applies to each bin for
+  // the n elements of 'input'.
+  template<class HP>
+  static BinProfile ofInput(const HP& desc, int32_t H, const typename HP::ALPHA* input, int64_t n) {
+    BinProfile p(H);
+    for (int64_t i = 0; i < n; i++) {
+      const uint32_t b = desc.f(H, input[i]).index;
+      if (b < (uint32_t)H) {
+        p.updates[b]++;
+      }
+    }
+    return p;
+  }
+
+  void writeCSV(const char* path) const {
+    FILE* f = fopen(path, "w");
+    if (!f) {
+      throw std::runtime_error(std::string("cannot open ") + path + ": " + strerror(errno));
+    }
+    fprintf(f, "bin,updates,retries\n");
+    for (size_t b = 0; b < updates.size(); b++) {
+      if (updates[b] != 0 || retries[b] != 0) {
+        fprintf(f, "%zu,%llu,%llu\n", b, (unsigned long long)updates[b],
+                (unsigned long long)retries[b]);
+      }
+    }
+    if (fclose(f) != 0) {
+      throw std::runtime_error(std::string("write failed: ") + path);
+    }
+  }
+
+  void writeBinary(const char* path) const {
+    FutharkDataWriter out(path, 1);
+    out.write(updates.data(), (int64_t)updates.size());
+    out.write(retries.data(), (int64_t)retries.size());
+  }
+
+  // A profile written by writeBinary.
+  static BinProfile read(const char* path) {
+    FutharkDataFile in(path);
+    if (in.size() != 2 || in[0].shape.size() != 1 || in[1].shape != in[0].shape) {
+      throw std::runtime_error(std::string(path) + ": not a histogram profile");
+    }
+    BinProfile p;
+    p.updates = in[0].copyOut<uint64_t>();
+    p.retries = in[1].copyOut<uint64_t>();
+    return p;
+  }
+
+private:
+  static uint64_t sum(const std::vector<uint64_t>& v) {
+    uint64_t s = 0;
+    for (size_t i = 0; i < v.size(); i++) {
+      s += v[i];
+    }
+    return s;
+  }
+};
+
+}
@@ -0,0 +1,219 @@
+// Single-pass histograms of real-valued data whose range is not known
+// in advance.
+//
+// The usual approach needs a first pass to find the minimum and
+// maximum key, and then a second pass to compute the histogram with
+// bins spread evenly over that range.  AdaptiveGenHist instead starts
+// from an estimated range [lo,hi) split into H bins, and whenever a
+// key falls outside the current range it coarsens the histogram: the
+// bin width is doubled (as many times as needed at once) and adjacent
+// pairs of bins are merged with 'opScal'.  Bins are always aligned to
+// the grid origin + j*width, with width = (hi-lo)/H * 2^level, so
+// merging is exact and the number of rebin events is bounded by
+// log2 of (final range / estimated range).
+//
+// The result is identical to a two-pass computation that uses the
+// final grid (see lo(), binWidth()), and that grid always covers every
+// key seen.  When the estimate is good, no rebinning happens and the
+// result is that of a plain histogram over [lo,hi).
+//
+// A descriptor for this mode maps an input element to a real-valued
+// key (which determines the bin) and a histogram value:
+//
+//   struct Count : genhist::RealHistDescriptor<float, int32_t> {
+//     static double key(float x) { return x; }
+//     static int32_t value(float) { return 1; }
+//     static int32_t ne() { return 0; }
+//     static int32_t opScal(int32_t a, int32_t b) { return a + b; }
+//   };
+//
+// Elements with non-finite keys are not binned; they are counted in
+// skipped(), as are keys so far from lo that their distance overflows
+// a double (only possible for keys near +-DBL_MAX).
+//
+// The window always contains bin 0 of the initial grid, so bin
+// numbers stay within (-H, H) however far the keys range; keys are
+// compared with the window in floating point, and only converted to
+// a bin number once they are known to fall inside it.
+
+#pragma once
+
+#include "genhist-pool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+namespace genhist {
+
+template<typename A, typename B>
+struct RealHistDescriptor {
+  typedef A ALPHA;
+  typedef B BETA;
+
+  // The real-valued key that determines the bin of an element.
+  inline static double key(ALPHA x);
+
+  // The value contributed to that bin.
+  inline static BETA value(ALPHA x);
+
+  inline static BETA ne();
+  inline static BETA opScal(BETA v1, BETA v2);
+};
+
+// floor(j / 2^k) for any j and k >= 0.  (Right shifts of negative
+// numbers are arithmetic on every compiler this library supports.)
+inline int64_t floorDiv2k(int64_t j, int k) {
+  return j >> std::min(k, 63);
+}
+
+template<class RP>
+class AdaptiveGenHist
+{
+public:
+  typedef typename RP::ALPHA ALPHA;
+  typedef typename RP::BETA BETA;
+
+  AdaptiveGenHist(int H, double lo, double hi, RP desc = RP())
+    : desc(desc), H(H), origin(lo), width0((hi - lo) / H),
+      level(0), j0(0), rebins(0), skip(0), bins(H, desc.ne()) {
+    if (H < 2 || !(hi > lo) || !std::isfinite(width0) || width0 <= 0) {
+      throw std::invalid_argument("AdaptiveGenHist: need H >= 2 and a finite range lo < hi");
+    }
+  }
+
+  void accumulate(const ALPHA* input, int64_t n) {
+    double w = binWidth();
+    for (int64_t i = 0; i < n; i++) {
+      const double key = desc.key(input[i]);
+      if (!std::isfinite(key)) {
+        skip++;
+        continue;
+      }
+      double q = floor((key - origin) / w);
+      if (!(q >= j0 && q < j0 + H)) {
+        if (!std::isfinite(key - origin)) {
+          skip++;
+          continue;
+        }
+        fit(key, key);
+        w = binWidth();
+        q = floor((key - origin) / w);
+      }
+      const int64_t j = (int64_t)q;
+      bins[j - j0] = desc.opScal(bins[j - j0], desc.value(input[i]));
+    }
+  }
+
+  // Fold another histogram with the same H, origin and initial width
+  // into this one, coarsening as needed.
+  void merge(const AdaptiveGenHist& other) {
+    if (other.H != H || other.origin != origin || other.width0 != width0) {
+      throw std::invalid_argument("AdaptiveGenHist: merging incompatible grids");
+    }
+    if (other.level > level) {
+      coarsen(other.level - level);
+    }
+    const int dk = level - other.level;
+    const int64_t lo_j = std::min(j0, floorDiv2k(other.j0, dk));
+    const int64_t hi_j = std::max(j0 + H - 1, floorDiv2k(other.j0 + H - 1, dk));
+    int k = 0;
+    while (floorDiv2k(hi_j, k) - floorDiv2k(lo_j, k) >= H) {
+      k++;
+    }
+    if (k > 0 || lo_j < j0) {
+      regrid(k, floorDiv2k(lo_j, k));
+    }
+    for (int p = 0; p < H; p++) {
+      const int64_t j = floorDiv2k(other.j0 + p, level - other.level);
+      bins[j - j0] = desc.opScal(bins[j - j0], other.bins[p]);
+    }
+    rebins += other.rebins;
+    skip += other.skip;
+  }
+
+  const BETA* result() const { return bins.data(); }
+
+  // The current grid: bin p covers [lo() + p*binWidth(), lo() + (p+1)*binWidth()).
+  double binWidth() const { return ldexp(width0, level); }
+  double lo() const { return origin + j0 * binWidth(); }
+  double hi() const { return origin + (j0 + H) * binWidth(); }
+
+  int numRebins() const { return rebins; }
+  int64_t skipped() const { return skip; }
+
+private:
+  // Coarsen until both keys fit in the window, in a single merge pass.
+  // The number of doublings is estimated from the binary exponents of
+  // the span of the window and the keys (halved, so that it cannot
+  // overflow) and of the window's width, whose ratio may exceed
+  // DBL_MAX; this bounds it from below, and it is then increased until
+  // the keys fit.  Bin numbers are computed as doubles, which hold them
+  // exactly once they fit.
+  void fit(double kmin, double kmax) {
+    const double half_span = std::max(kmax, hi()) * 0.5 - std::min(kmin, lo()) * 0.5;
+    int k = std::max(1, ilogb(half_span) - ilogb(binWidth()) - ilogb((double)H) - 2);
+    double lo_j, hi_j;
+    for (;; k++) {
+      const double w = ldexp(width0, level + k);
+      lo_j = std::min((double)floorDiv2k(j0, k), floor((kmin - origin) / w));
+      hi_j = std::max((double)floorDiv2k(j0 + H - 1, k), floor((kmax - origin) / w));
+      if (hi_j - lo_j < H) {
+        break;
+      }
+    }
+    regrid(k, (int64_t)lo_j);
+  }
+
+  void coarsen(int k) {
+    regrid(k, floorDiv2k(j0, k));
+  }
+
+  // Double the bin width k times and move the window to start at
+  // 'new_j0' (in units of the new width).
+  void regrid(int k, int64_t new_j0) {
+    std::vector<BETA> nbins(H, desc.ne());
+    for (int p = 0; p < H; p++) {
+      const int64_t j = floorDiv2k(j0 + p, k) - new_j0;
+      nbins[j] = desc.opScal(nbins[j], bins[p]);
+    }
+    bins.swap(nbins);
+    level += k;
+    j0 = new_j0;
+    rebins++;
+  }
+
+  RP desc;
+  int H;
+  double origin, width0;
+  int level;
+  int64_t j0;
+  int rebins;
+  int64_t skip;
+  std::vector<BETA> bins;
+};
+
+// Compute an adaptive histogram over 'n' elements with 'num_threads'
+// threads (zero means those of the default WorkerPool), each building
+// its own AdaptiveGenHist over a contiguous slice before they are
+// merged.  The threads come from 'pool' if given.
+template<class RP>
+AdaptiveGenHist<RP>
+adaptiveHisto(const typename RP::ALPHA* input, int64_t n, int H, double lo, double hi,
+              int num_threads = 0, RP desc = RP(), WorkerPool* pool = NULL) {
+  std::unique_ptr<WorkerPool> owned_pool;
+  pool = selectPool(pool, num_threads, owned_pool);
+  const int T = pool->numThreads();
+  std::vector<AdaptiveGenHist<RP> > parts(T, AdaptiveGenHist<RP>(H, lo, hi, desc));
+  pool->run([&](int tid) {
+      parts[tid].accumulate(input + n * tid / T, n * (tid+1) / T - n * tid / T);
+    });
+  for (int tid = 1; tid < T; tid++) {
+    parts[0].merge(parts[tid]);
+  }
+  return parts[0];
+}
+
+}
@@ -0,0 +1,190 @@
+// SIMD update kernels for add-style histograms on x86 CPUs.
+//
+// A descriptor whose BETA is a 32-bit integer and whose 'opScal' is
+// addition may declare
+//
+//   static const bool simd_add = true;
+//
+// The CPU library then computes the (index, value) pairs of a batch of
+// elements with the scalar 'f', and applies them to a private
+// subhistogram a vector at a time:
+//
+// * with AVX-512 (F and CD), sixteen lanes are gathered, added to and
+//   scattered back.  Lanes with equal indices are found with
+//   vpconflictd, and their values are summed into the last such lane
+//   by pointer jumping along the conflict chains, which the in-order
+//   scatter makes the one that is written last.
+//
+// * with AVX2, which has gathers but no scatters, eight lanes are
+//   gathered and added to, and stored one at a time, unless two of
+//   them have the same index, in which case the vector is applied
+//   lane by lane.
+//
+// The kernel is chosen at run time (see detectSimd), and the scalar
+// loop is used on other CPUs and compilers.
+
+#pragma once
+
+#include <cstdint>
+#include <type_traits>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define GENHIST_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+namespace genhist {
+
+enum SimdLevel {SIMD_SCALAR, SIMD_AVX2, SIMD_AVX512};
+
+inline const char* simdLevelName(SimdLevel l) {
+  return l == SIMD_AVX512 ? "AVX-512" : l == SIMD_AVX2 ? "AVX2" : "scalar";
+}
+
+// The widest kernel that this CPU (and operating system) supports.
+inline SimdLevel detectSimd() {
+#ifdef GENHIST_X86_SIMD
+  static const SimdLevel level = [] {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512cd")) {
+      return SIMD_AVX512;
+    }
+    return __builtin_cpu_supports("avx2") ? SIMD_AVX2 : SIMD_SCALAR;
+  }();
+  return level;
+#else
+  return SIMD_SCALAR;
+#endif
+}
+
+// Whether HP declares 'simd_add' and has a 32-bit integer BETA.
+template<class HP, class = void>
+struct SimdAdd {
+  static const bool value = false;
+};
+
+template<class HP>
+struct SimdAdd<HP, typename std::enable_if<HP::simd_add>::type> {
+  static const bool value = std::is_integral<typename HP::BETA>::value &&
+    sizeof(typename HP::BETA) == 4;
+};
+
+// The bins of a subhistogram: bin b is at
+// hist[(b >> shift) * group + (b & mask)].
+struct SimdSlots {
+  int shift;
+  int32_t group;
+  uint32_t mask;
+  inline int64_t at(uint32_t b) const {
+    return (int64_t)(b >> shift) * group + (b & mask);
+  }
+};
+
+inline void
+scalarAdd(int32_t* hist, const uint32_t* idx, const int32_t* val, int n, SimdSlots s) {
+  for (int i = 0; i < n; i++) {
+    int32_t& h = hist[s.at(idx[i])];
+    h = (int32_t)((uint32_t)h + (uint32_t)val[i]);
+  }
+}
+
+#ifdef GENHIST_X86_SIMD
+
+__attribute__((target("avx512f,avx512cd"))) inline void
+avx512Add(int32_t* hist, const uint32_t* idx, const int32_t* val, int n, SimdSlots s) {
+  const __m512i shift = _mm512_set1_epi32(s.shift);
+  const __m512i group = _mm512_set1_epi32(s.group);
+  const __m512i mask  = _mm512_set1_epi32(s.mask);
+  const __m512i all31 = _mm512_set1_epi32(31);
+  const __m512i none  = _mm512_set1_epi32(-1);
+  for (int i = 0; i < n; i += 16) {
+    const __mmask16 live = n - i >= 16 ? (__mmask16)0xffff : (__mmask16)((1u << (n - i)) - 1);
+    const __m512i b = _mm512_maskz_loadu_epi32(live, idx + i);
+    __m512i v = _mm512_maskz_loadu_epi32(live, val + i);
+    const __m512i pos = _mm512_add_epi32(_mm512_mullo_epi32(_mm512_maskz_srlv_epi32(live, b, shift), group),
+                                         _mm512_and_si512(b, mask));
+    // conf has bit j set in lane k if lane j < k has the same position;
+    // perm is the nearest such j, or -1
+    const __m512i conf = _mm512_maskz_conflict_epi32(live, pos);
+    __mmask16 todo = _mm512_test_epi32_mask(conf, conf);
+    if (todo) {
+      __m512i perm = _mm512_sub_epi32(all31, _mm512_lzcnt_epi32(conf));
+      do {
+        const __m512i pred = _mm512_maskz_permutexvar_epi32(todo, perm, v);
+        perm = _mm512_mask_permutexvar_epi32(perm, todo, perm, perm);
+        v = _mm512_mask_add_epi32(v, todo, v, pred);
+        todo = _mm512_mask_cmpneq_epi32_mask(todo, perm, none);
+      } while (todo);
+    }
+    const __m512i h = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), live, pos, hist, 4);
+    _mm512_mask_i32scatter_epi32(hist, live, pos, _mm512_add_epi32(h, v), 4);
+  }
+}
+
+__attribute__((target("avx2"))) inline void
+avx2Add(int32_t* hist, const uint32_t* idx, const int32_t* val, int n, SimdSlots s) {
+  const __m256i shift = _mm256_set1_epi32(s.shift);
+  const __m256i group = _mm256_set1_epi32(s.group);
+  const __m256i mask  = _mm256_set1_epi32(s.mask);
+  // rotations by 1-4 lanes compare every pair of the 8 lanes
+  const __m256i rot1 = _mm256_setr_epi32(1, 2, 3, 4, 5, 6, 7, 0);
+  const __m256i rot2 = _mm256_setr_epi32(2, 3, 4, 5, 6, 7, 0, 1);
+  const __m256i rot3 = _mm256_setr_epi32(3, 4, 5, 6, 7, 0, 1, 2);
+  const __m256i rot4 = _mm256_setr_epi32(4, 5, 6, 7, 0, 1, 2, 3);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m256i b = _mm256_loadu_si256((const __m256i*)(idx + i));
+    const __m256i v = _mm256_loadu_si256((const __m256i*)(val + i));
+    const __m256i pos = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_srlv_epi32(b, shift), group),
+                                         _mm256_and_si256(b, mask));
+    __m256i eq = _mm256_cmpeq_epi32(pos, _mm256_permutevar8x32_epi32(pos, rot1));
+    eq = _mm256_or_si256(eq, _mm256_cmpeq_epi32(pos, _mm256_permutevar8x32_epi32(pos, rot2)));
+    eq = _mm256_or_si256(eq, _mm256_cmpeq_epi32(pos, _mm256_permutevar8x32_epi32(pos, rot3)));
+    eq = _mm256_or_si256(eq, _mm256_cmpeq_epi32(pos, _mm256_permutevar8x32_epi32(pos, rot4)));
+    if (!_mm256_testz_si256(eq, eq)) {
+      scalarAdd(hist, idx + i, val + i, 8, s);
+      continue;
+    }
+    const __m256i h = _mm256_add_epi32(_mm256_i32gather_epi32(hist, pos, 4), v);
+    alignas(32) int32_t p[8], r[8];
+    _mm256_store_si256((__m256i*)p, pos);
+    _mm256_store_si256((__m256i*)r, h);
+    for (int l = 0; l < 8; l++) {
+      hist[p[l]] = r[l];
+    }
+  }
+  scalarAdd(hist, idx + i, val + i, n - i, s);
+}
+
+#endif
+
+// Add val[i] to bin idx[i] of 'hist', for i < n, with the kernel for
+// 'level' (which must not exceed detectSimd()).  Positions must fit in
+// an int32_t.
+template<class HP>
+inline typename std::enable_if<SimdAdd<HP>::value>::type
+simdAdd(SimdLevel level, typename HP::BETA* hist, const uint32_t* idx,
+        const typename HP::BETA* val, int n, SimdSlots s) {
+  int32_t* h = (int32_t*)hist;
+  const int32_t* v = (const int32_t*)val;
+#ifdef GENHIST_X86_SIMD
+  if (level == SIMD_AVX512) {
+    avx512Add(h, idx, v, n, s);
+    return;
+  }
+  if (level == SIMD_AVX2) {
+    avx2Add(h, idx, v, n, s);
+    return;
+  }
+#else
+  (void)level;
+#endif
+  scalarAdd(h, idx, v, n, s);
+}
+
+// Other descriptors never reach the SIMD kernels.
+template<class HP>
+inline typename std::enable_if<!SimdAdd<HP>::value>::type
+simdAdd(SimdLevel, typename HP::BETA*, const uint32_t*, const typename HP::BETA*, int, SimdSlots) { }
+
+}
@@ -0,0 +1,220 @@
+// Out-of-core driver for the CPU generalized histogram library.
+//
+// Computes a single histogram over a file of raw ALPHA elements that
+// may be much larger than main memory.  The file is read in large
+// aligned blocks by a background thread that stays 'depth' blocks
+// ahead of the histogram engine, so that I/O and computation overlap
+// and the resident footprint is bounded by depth*block_bytes no matter
+// how large the file is.  Consumed ranges are dropped from the page
+// cache with POSIX_FADV_DONTNEED so the kernel does not keep them
+// around either.
+//
+// Usage:
+//
+//   genhist::HostGenHist<HP> hist(genhist::host_default, RF, H, block_elems);
+//   genhist::StreamConfig cfg = genhist::stream_default;
+//   int64_t n = genhist::streamHisto(hist, "input.bin", cfg);
+//
+// after which hist.result() holds the histogram of all 'n' elements.
+
+#pragma once
+
+#include "genhist-host.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace genhist {
+
+struct StreamConfig
+{
+  const size_t block_bytes; // rounded down to whole pages and elements
+  const int depth;          // number of blocks in flight
+  const int64_t offset;     // bytes to skip at the start of the file
+  const int64_t length;     // bytes to process; negative means to the end
+  const PagePolicy pages;   // requested for the block buffers
+};
+
+const StreamConfig stream_default{ 64*1024*1024, 3, 0, -1, TRANSPARENT_HUGE };
+
+// Reads a byte range of a file into a ring of 'depth' page-aligned
+// buffers on a background thread.  next() hands out filled buffers in
+// file order; release() returns the oldest one to the reader.
+class BlockReader
+{
+public:
+  BlockReader(const char* path, int64_t offset, int64_t length, size_t block_bytes, size_t elem_size, int depth,
+              PagePolicy pages = SMALL_PAGES)
+    : offset(offset), depth(std::max(depth, 1)), failed(0), stop(false), head(0), tail(0) {
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+      throw std::runtime_error(std::string("cannot open ") + path + ": " + strerror(errno));
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < offset) {
+      close(fd);
+      throw std::runtime_error(std::string("cannot stat ") + path);
+    }
+    if (length < 0 || length > st.st_size - offset) {
+      length = st.st_size - offset;
+    }
+    this->length = (length / elem_size) * elem_size;
+
+    // A block must hold whole elements and start page-aligned in the file
+    // (relative to 'offset'), so round to a multiple of both.
+    const size_t page = sysconf(_SC_PAGESIZE);
+    size_t unit = page;
+    while (unit % elem_size != 0) {
+      unit += page;
+    }
+    this->block_bytes = std::max(unit, (block_bytes / unit) * unit);
+
+    posix_fadvise(fd, offset, this->length, POSIX_FADV_SEQUENTIAL);
+
+    for (int i = 0; i < this->depth; i++) {
+      try {
+        bufs.push_back(pageAlloc(this->block_bytes, pages));
+      } catch (...) {
+        cleanup();
+        throw;
+      }
+      lens.push_back(0);
+    }
+    reader = std::thread(&BlockReader::readLoop, this);
+  }
+
+  ~BlockReader() {
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      stop = true;
+    }
+    cv.notify_all();
+    reader.join();
+    cleanup();
+  }
+
+  // Returns the next block and its length in bytes, or NULL at the
+  // end of the file.  Throws if the reader hit an I/O error.
+  const char* next(size_t* len) {
+    std::unique_lock<std::mutex> lock(mtx);
+    const int64_t num_blocks = (length + block_bytes - 1) / block_bytes;
+    cv.wait(lock, [&] { return failed != 0 || head > tail || tail == num_blocks; });
+    if (failed != 0) {
+      throw std::runtime_error(std::string("read failed: ") + strerror(failed));
+    }
+    if (tail == num_blocks) {
+      return NULL;
+    }
+    *len = lens[tail % depth];
+    return (const char*)bufs[tail % depth].ptr;
+  }
+
+  // Hands the block last returned by next() back to the reader.
+  void release() {
+    int64_t done_off;
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      done_off = offset + tail * (int64_t)block_bytes;
+      tail++;
+    }
+    cv.notify_all();
+    posix_fadvise(fd, done_off, block_bytes, POSIX_FADV_DONTNEED);
+  }
+
+  int64_t bytes() const { return length; }
+  size_t blockBytes() const { return block_bytes; }
+
+  // The page size policy that took effect for the block buffers.
+  PagePolicy pagePolicy() const { return bufs[0].policy; }
+
+private:
+  void readLoop() {
+    const int64_t num_blocks = (length + block_bytes - 1) / block_bytes;
+    for (int64_t b = 0; b < num_blocks; b++) {
+      {
+        std::unique_lock<std::mutex> lock(mtx);
+        cv.wait(lock, [&] { return stop || head - tail < depth; });
+        if (stop) {
+          return;
+        }
+      }
+      char* buf = (char*)bufs[b % depth].ptr;
+      const int64_t beg = b * (int64_t)block_bytes;
+      const size_t want = (size_t)std::min((int64_t)block_bytes, length - beg);
+      size_t got = 0;
+      int err = 0;
+      while (got < want) {
+        ssize_t r = pread(fd, buf + got, want - got, offset + beg + got);
+        if (r < 0 && errno == EINTR) {
+          continue;
+        }
+        if (r <= 0) {
+          err = r < 0 ? errno : EIO;
+          break;
+        }
+        got += r;
+      }
+      {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (err != 0) {
+          failed = err;
+        } else {
+          lens[b % depth] = want;
+          head++;
+        }
+      }
+      cv.notify_all();
+      if (err != 0) {
+        return;
+      }
+    }
+  }
+
+  void cleanup() {
+    for (size_t i = 0; i < bufs.size(); i++) {
+      pageFree(bufs[i]);
+    }
+    bufs.clear();
+    close(fd);
+  }
+
+  int fd;
+  int64_t offset, length;
+  size_t block_bytes;
+  const int depth;
+  std::vector<PageBuffer> bufs;
+  std::vector<size_t> lens;
+
+  std::mutex mtx;
+  std::condition_variable cv;
+  int failed;
+  bool stop;
+  int64_t head, tail; // blocks filled / blocks consumed
+  std::thread reader;
+};
+
+// Fold the histogram of every element in the file at 'path' into
+// 'hist' (which is not reset first).  Returns the number of elements
+// processed.
+template<class HP>
+int64_t streamHisto(HostGenHist<HP>& hist, const char* path, StreamConfig cfg = stream_default) {
+  typedef typename HP::ALPHA ALPHA;
+  BlockReader reader(path, cfg.offset, cfg.length, cfg.block_bytes, sizeof(ALPHA), cfg.depth, cfg.pages);
+  int64_t n = 0;
+  size_t len;
+  const char* block;
+  while ((block = reader.next(&len)) != NULL) {
+    hist.accumulate((const ALPHA*)block, len / sizeof(ALPHA));
+    n += len / sizeof(ALPHA);
+    reader.release();
+  }
+  return n;
+}
+
+}
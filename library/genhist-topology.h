@@ -0,0 +1,172 @@
+// The core and cache topology of the CPUs that the process may run on.
+//
+// On a CPU, the natural domains for threads that share a subhistogram
+// are the hardware threads of a core (which share its L1 and L2), the
+// cores of an L2 cluster, and the cores of a last-level cache; atomics
+// across sockets are the most expensive of all.  CpuTopology reads
+// these domains from /sys/devices/system/cpu and orders the CPUs so
+// that every domain is a contiguous range:
+//
+// * WorkerPool pins worker i to cpus[i], so threads with consecutive
+//   ids share as many caches as possible, and
+//
+// * HostGenHist can then form its cooperation groups (the C threads
+//   tid/C that share a subhistogram) within sharing domains (see
+//   'topology_coop' in HostGenHistConfig).
+//
+// The machine is assumed to be homogeneous: the domain sizes are those
+// of the first CPU.  Without sysfs, every CPU is its own core and all
+// share one cache of unknown size.
+
+#pragma once
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+namespace genhist {
+
+struct CpuTopology
+{
+  struct Cpu {
+    int id;
+    int package;
+    int core; // the lowest CPU id of its core
+    int l2;   // the lowest CPU id sharing its L2, or -1
+    int llc;  // the lowest CPU id sharing its last-level cache, or -1
+  };
+
+  std::vector<Cpu> cpus;  // ordered by package, LLC, L2, core, id
+  size_t l2_bytes;        // per L2 instance; zero if unknown
+  size_t llc_bytes;       // per last-level cache instance; zero if unknown
+  int smt_threads;        // allowed CPUs per core
+  int l2_threads;         // allowed CPUs per L2
+  int llc_threads;        // allowed CPUs per last-level cache
+  int package_threads;    // allowed CPUs per package
+
+  // The topology of the CPUs in the affinity mask of the process at
+  // the first call.
+  static const CpuTopology& system() {
+    static const CpuTopology topo = read();
+    return topo;
+  }
+
+  static CpuTopology read() {
+    CpuTopology topo;
+    topo.l2_bytes = topo.llc_bytes = 0;
+    std::vector<int> allowed;
+#ifdef __linux__
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+      for (int c = 0; c < CPU_SETSIZE; c++) {
+        if (CPU_ISSET(c, &set)) {
+          allowed.push_back(c);
+        }
+      }
+    }
+#endif
+    if (allowed.empty()) {
+      allowed.push_back(0);
+    }
+    int llc_level = 0;
+    for (size_t i = 0; i < allowed.size(); i++) {
+      Cpu cpu;
+      cpu.id = allowed[i];
+      cpu.package = readInt(cpuPath(cpu.id, "topology/physical_package_id"), 0);
+      cpu.core = firstOf(readLine(cpuPath(cpu.id, "topology/thread_siblings_list")), cpu.id);
+      cpu.l2 = cpu.llc = -1;
+      for (int k = 0; ; k++) {
+        const std::string dir = cpuPath(cpu.id, "cache/index" + std::to_string(k) + "/");
+        const int level = readInt(dir + "level", -1);
+        if (level < 0) {
+          break;
+        }
+        if (readLine(dir + "type") == "Instruction") {
+          continue;
+        }
+        const int first = firstOf(readLine(dir + "shared_cpu_list"), cpu.id);
+        const size_t bytes = parseSize(readLine(dir + "size"));
+        if (level == 2) {
+          cpu.l2 = first;
+          topo.l2_bytes = bytes;
+        }
+        if (level >= llc_level) {
+          llc_level = level;
+          cpu.llc = first;
+          topo.llc_bytes = bytes;
+        }
+      }
+      topo.cpus.push_back(cpu);
+    }
+    std::sort(topo.cpus.begin(), topo.cpus.end(), [](const Cpu& a, const Cpu& b) {
+        if (a.package != b.package) return a.package < b.package;
+        if (a.llc != b.llc) return a.llc < b.llc;
+        if (a.l2 != b.l2) return a.l2 < b.l2;
+        if (a.core != b.core) return a.core < b.core;
+        return a.id < b.id;
+      });
+    const Cpu& c0 = topo.cpus[0];
+    topo.smt_threads = topo.l2_threads = topo.llc_threads = topo.package_threads = 0;
+    for (size_t i = 0; i < topo.cpus.size(); i++) {
+      const Cpu& c = topo.cpus[i];
+      topo.smt_threads     += c.core == c0.core;
+      topo.l2_threads      += c.l2 == c0.l2 && c.package == c0.package;
+      topo.llc_threads     += c.llc == c0.llc && c.package == c0.package;
+      topo.package_threads += c.package == c0.package;
+    }
+    if (c0.l2 < 0) {
+      topo.l2_threads = topo.smt_threads;
+    }
+    if (c0.llc < 0) {
+      topo.llc_threads = topo.package_threads;
+    }
+    return topo;
+  }
+
+private:
+  static std::string cpuPath(int cpu, const std::string& file) {
+    return "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/" + file;
+  }
+
+  // The first line of a file without its newline; empty if unreadable.
+  static std::string readLine(const std::string& path) {
+    char buf[256] = "";
+    FILE* f = fopen(path.c_str(), "r");
+    if (!f) {
+      return "";
+    }
+    const bool ok = fgets(buf, sizeof(buf), f) != NULL;
+    fclose(f);
+    if (!ok) {
+      return "";
+    }
+    buf[strcspn(buf, "\n")] = 0;
+    return buf;
+  }
+
+  static int readInt(const std::string& path, int dflt) {
+    const std::string s = readLine(path);
+    return s.empty() ? dflt : atoi(s.c_str());
+  }
+
+  // The first CPU of a list such as "0-3,8-11".
+  static int firstOf(const std::string& list, int dflt) {
+    return list.empty() ? dflt : atoi(list.c_str());
+  }
+
+  // A cache size such as "2048K".
+  static size_t parseSize(const std::string& s) {
+    const size_t n = strtoull(s.c_str(), NULL, 10);
+    const char unit = s.empty() ? 0 : s[s.size() - 1];
+    return unit == 'K' ? n << 10 : unit == 'M' ? n << 20 : unit == 'G' ? n << 30 : n;
+  }
+};
+
+}
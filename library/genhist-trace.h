@@ -0,0 +1,156 @@
+// Timeline tracing in the Chrome trace-event format.
+//
+// A Tracer collects complete events: a name, a category, a track (a
+// "thread" in the viewer), a start time and a duration in
+// microseconds, and an optional integer argument.  writeJSON writes
+// them as a trace-event JSON file, which chrome://tracing and
+// ui.perfetto.dev load directly, so serial phases and imbalance
+// between threads can be seen without an external profiler.
+//
+// The engines record their phases on a Tracer given to setTracer:
+// HostGenHist the sampling, initialisation, chunk and reduction phases
+// of each pass on the calling thread's track (0), and every block of
+// input on the track of the worker that processed it; the GPU engines
+// their kernels on a track of their own (see genhist.cu.h).
+//
+// Scopes are timed with TraceScope, which does nothing for a NULL
+// tracer, so code that is not being traced pays only a test.  Events
+// are appended under a lock, so scopes should be coarse (the engines
+// trace blocks of thousands of elements, not single updates).
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <errno.h>
+
+namespace genhist {
+
+class Tracer
+{
+public:
+  Tracer() : origin(std::chrono::steady_clock::now()) { }
+
+  // Microseconds since the tracer was created.
+  double now() const {
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - origin).count();
+  }
+
+  // Record an event on 'track' that started at 'ts' and lasted 'dur'
+  // microseconds.  'arg_name' may be NULL.
+  void record(const char* name, const char* cat, int track, double ts, double dur,
+              const char* arg_name = NULL, int64_t arg = 0) {
+    const Event e = { name, cat, track, ts, dur, arg_name, arg };
+    std::lock_guard<std::mutex> lk(lock);
+    events.push_back(e);
+  }
+
+  // Show 'track' under 'name' in the viewer.
+  void nameTrack(int track, const std::string& name) {
+    std::lock_guard<std::mutex> lk(lock);
+    tracks[track] = name;
+  }
+
+  size_t numEvents() const {
+    std::lock_guard<std::mutex> lk(lock);
+    return events.size();
+  }
+
+  void clear() {
+    std::lock_guard<std::mutex> lk(lock);
+    events.clear();
+  }
+
+  void writeJSON(const char* path) const {
+    FILE* f = fopen(path, "w");
+    if (!f) {
+      throw std::runtime_error(std::string("cannot open ") + path + ": " + strerror(errno));
+    }
+    std::lock_guard<std::mutex> lk(lock);
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    bool first = true;
+    for (std::map<int, std::string>::const_iterator t = tracks.begin(); t != tracks.end(); ++t) {
+      fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+              first ? "" : ",\n", t->first, escape(t->second.c_str()).c_str());
+      first = false;
+    }
+    for (size_t i = 0; i < events.size(); i++) {
+      const Event& e = events[i];
+      fprintf(f, "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f",
+              first ? "" : ",\n", escape(e.name).c_str(), escape(e.cat).c_str(), e.track, e.ts, e.dur);
+      if (e.arg_name) {
+        fprintf(f, ",\"args\":{\"%s\":%lld}", escape(e.arg_name).c_str(), (long long)e.arg);
+      }
+      fprintf(f, "}");
+      first = false;
+    }
+    fprintf(f, "\n]}\n");
+    if (fclose(f) != 0) {
+      throw std::runtime_error(std::string("write failed: ") + path);
+    }
+  }
+
+private:
+  struct Event {
+    const char* name; // string literals, not copied
+    const char* cat;
+    int track;
+    double ts, dur;
+    const char* arg_name;
+    int64_t arg;
+  };
+
+  static std::string escape(const char* s) {
+    std::string r;
+    for (; *s; s++) {
+      if (*s == '"' || *s == '\\') {
+        r += '\\';
+      }
+      r += *s;
+    }
+    return r;
+  }
+
+  const std::chrono::steady_clock::time_point origin;
+  mutable std::mutex lock;
+  std::vector<Event> events;
+  std::map<int, std::string> tracks;
+};
+
+// Records the lifetime of the scope as an event, if 'tracer' is not NULL.
+class TraceScope
+{
+public:
+  TraceScope(Tracer* tracer, const char* name, const char* cat, int track,
+             const char* arg_name = NULL, int64_t arg = 0)
+    : tracer(tracer), name(name), cat(cat), track(track), arg_name(arg_name), arg(arg),
+      start(tracer ? tracer->now() : 0) { }
+
+  ~TraceScope() {
+    if (tracer) {
+      tracer->record(name, cat, track, start, tracer->now() - start, arg_name, arg);
+    }
+  }
+
+  TraceScope(const TraceScope&) = delete;
+  TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+  Tracer* const tracer;
+  const char* name;
+  const char* cat;
+  const int track;
+  const char* arg_name;
+  const int64_t arg;
+  const double start;
+};
+
+}
@@ -0,0 +1,224 @@
+// Sliding-window generalized histograms on the CPU.
+//
+// WindowGenHist maintains the histogram of the most recent W input
+// elements (and optionally only those not older than a time cutoff)
+// while elements are pushed in batches.  Every update costs
+// O(batch), independently of W: the (index,value) pairs of the
+// elements in the window are kept in a ring buffer, so 'f' is computed
+// once per element and expired elements can be removed without
+// touching the input again.
+//
+// How an expired element is removed depends on the descriptor:
+//
+// * If the descriptor declares an inverse,
+//
+//     static BETA opInv(BETA v);
+//
+//   such that opScal(opScal(a, v), opInv(v)) == a (e.g. negation for
+//   AddI32), the element is subtracted from its bin directly.
+//
+// * Otherwise (min, max, argmax, saturated add, ...), every bin is a
+//   FIFO queue aggregated with the two-stack scheme: the older part of
+//   the queue stores suffix aggregates, the newer part a running
+//   aggregate, and the older part is rebuilt from the newer part when
+//   it runs empty.  This costs amortised O(1) per insertion and
+//   eviction, and needs no inverse.
+//
+// In both cases result() is kept up to date after every call.
+// Elements whose index is not below H occupy their place in the window
+// but update no bin, as in reduce_by_index.
+
+#pragma once
+
+#include "genhist-common.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+namespace genhist {
+
+// Does the descriptor declare 'opInv'?
+template<class HP>
+struct HasInverse {
+  template<class U> static char test(decltype(&U::opInv));
+  template<class U> static long test(...);
+  static const bool value = sizeof(test<HP>(0)) == 1;
+};
+
+template<class HP>
+class WindowGenHist
+{
+public:
+  typedef typename HP::ALPHA ALPHA;
+  typedef typename HP::BETA BETA;
+
+  // A window of at most W elements over a histogram of H bins.
+  WindowGenHist(int H, int64_t W, HP desc = HP())
+    : desc(desc), H(H), W(W), head(0), size(0), ring(W), stamps(0) {
+    if (H <= 0 || W <= 0) {
+      throw std::invalid_argument("WindowGenHist: H and W must be positive");
+    }
+    histo.assign(H, desc.ne());
+    if (!invertible) {
+      next.resize(W);
+      agg.resize(W);
+      bin_head.assign(H, -1);
+      bin_tail.assign(H, -1);
+      front_len.assign(H, 0);
+      back_agg.assign(H, desc.ne());
+    }
+  }
+
+  // Insert a batch of elements, evicting the oldest ones beyond W.
+  void push(const ALPHA* input, int64_t n) {
+    if (!stamps.empty()) {
+      throw std::logic_error("WindowGenHist: timestamps must be given with every push");
+    }
+    pushBatch(input, n, NULL);
+  }
+
+  // As above, but also record a timestamp per element (which must be
+  // non-decreasing) for use with expire().
+  void push(const ALPHA* input, int64_t n, const int64_t* ts) {
+    if (stamps.empty()) {
+      if (size > 0) {
+        throw std::logic_error("WindowGenHist: timestamps must be given from the first push");
+      }
+      stamps.resize(W);
+    }
+    pushBatch(input, n, ts);
+  }
+
+  // Evict every element with a timestamp older than 'cutoff'.
+  void expire(int64_t cutoff) {
+    if (stamps.empty()) {
+      throw std::logic_error("WindowGenHist: expire() needs timestamped pushes");
+    }
+    while (size > 0 && stamps[head] < cutoff) {
+      evictOldest();
+    }
+  }
+
+  const BETA* result() const {
+    return histo.data();
+  }
+
+  int64_t windowSize() const { return size; }
+
+  static const bool invertible = HasInverse<HP>::value;
+
+private:
+  void pushBatch(const ALPHA* input, int64_t n, const int64_t* ts) {
+    // Only the last W elements of an oversized batch can survive.
+    if (n > W) {
+      input += n - W;
+      if (ts) ts += n - W;
+      n = W;
+    }
+    const int64_t overflow = size + n - W;
+    for (int64_t i = 0; i < overflow; i++) {
+      evictOldest();
+    }
+    for (int64_t i = 0; i < n; i++) {
+      const int64_t slot = (head + size) % W;
+      ring[slot] = desc.f(H, input[i]);
+      if (ts) {
+        stamps[slot] = ts[i];
+      }
+      size++;
+      if (ring[slot].index < (uint32_t)H) {
+        insert(slot, std::integral_constant<bool, invertible>());
+      }
+    }
+  }
+
+  void evictOldest() {
+    const int64_t slot = head;
+    head = (head + 1) % W;
+    size--;
+    if (ring[slot].index < (uint32_t)H) {
+      evict(slot, std::integral_constant<bool, invertible>());
+    }
+  }
+
+  // Invertible operators: apply directly.
+  void insert(int64_t slot, std::true_type) {
+    const uint32_t b = ring[slot].index;
+    histo[b] = desc.opScal(histo[b], ring[slot].value);
+  }
+
+  void evict(int64_t slot, std::true_type) {
+    const uint32_t b = ring[slot].index;
+    histo[b] = desc.opScal(histo[b], desc.opInv(ring[slot].value));
+  }
+
+  // Non-invertible operators: a two-stack queue per bin, threaded
+  // through the ring buffer.  bin_head is the oldest element of the
+  // bin; the first front_len elements of the bin form the front stack
+  // (each holding the aggregate of itself and the rest of the front
+  // stack), and the remaining ones the back stack, summarised by
+  // back_agg.
+  void insert(int64_t slot, std::false_type) {
+    const uint32_t b = ring[slot].index;
+    next[slot] = -1;
+    if (bin_tail[b] < 0) {
+      bin_head[b] = slot;
+    } else {
+      next[bin_tail[b]] = slot;
+    }
+    bin_tail[b] = slot;
+    back_agg[b] = desc.opScal(back_agg[b], ring[slot].value);
+    refresh(b);
+  }
+
+  void evict(int64_t slot, std::false_type) {
+    const uint32_t b = ring[slot].index;
+    if (front_len[b] == 0) {
+      flip(b);
+    }
+    bin_head[b] = next[slot];
+    if (bin_head[b] < 0) {
+      bin_tail[b] = -1;
+    }
+    front_len[b]--;
+    refresh(b);
+  }
+
+  // Move the back stack of bin b to the (empty) front stack, computing
+  // suffix aggregates from the newest element towards the oldest.
+  void flip(uint32_t b) {
+    scratch.clear();
+    for (int64_t s = bin_head[b]; s >= 0; s = next[s]) {
+      scratch.push_back(s);
+    }
+    BETA acc = desc.ne();
+    for (size_t i = scratch.size(); i-- > 0; ) {
+      acc = desc.opScal(ring[scratch[i]].value, acc);
+      agg[scratch[i]] = acc;
+    }
+    front_len[b] = scratch.size();
+    back_agg[b] = desc.ne();
+  }
+
+  void refresh(uint32_t b) {
+    histo[b] = front_len[b] > 0 ? desc.opScal(agg[bin_head[b]], back_agg[b]) : back_agg[b];
+  }
+
+  const HP desc;
+  const int H;
+  const int64_t W;
+  int64_t head, size;
+  std::vector<indval<BETA> > ring;
+  std::vector<int64_t> stamps;
+  std::vector<BETA> histo;
+
+  // only used for non-invertible operators
+  std::vector<int64_t> next, bin_head, bin_tail, front_len;
+  std::vector<BETA> agg, back_agg;
+  std::vector<int64_t> scratch;
+};
+
+}
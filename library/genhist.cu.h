@@ -5,10 +5,11 @@
 // description follows.
 //
 // The GenHistConfig class defines various configurable parameters for
-// how the hardware should be exploited.  The 'rtx2080' variable
-// contains parameters that we found worked well on an RTX2080 Ti GPU
-// (and which we expect will also work well on most other recent
-// GPUs).
+// how the hardware should be exploited, including an optional budget
+// for the device memory that the subhistograms may occupy.  The
+// 'rtx2080' variable contains parameters that we found worked well on
+// an RTX2080 Ti GPU (and which we expect will also work well on most
+// other recent GPUs).
 //
 // The main entry point is the two classes LocalMemoryGenHist and
 // GlobalMemoryGenHist, which encapsulate the state (mostly memory
@@ -17,28 +18,63 @@
 // which must be given at creation time).  The two classes then define
 // a method 'exec' for actually computing a generalized histogram, and
 // 'result' for obtaining the memory in which the histogram is stored.
+// Alternatively, 'execInto' folds the histogram into an existing
+// device array of H bins with 'opScal' (like 'reduce_by_index dest'
+// in Futhark), as part of the final reduction.  With 'setTracer', the
+// kernels of every exec are timed and recorded on a Tracer, which
+// writes them as a Chrome trace (see genhist-trace.h).
 //
 // These classes are templates, which are parameterised with the
 // histogram descriptor to perform.  This descriptor must inherit from
 // HistDescriptor (or at least implement the same interface).
+// HistDescriptor itself lives in genhist-common.h, which is shared
+// with the multicore CPU library in genhist-host.h.
+//
+// When a sample of the input shows long runs of consecutive elements
+// with the same bin index, the kernels combine each run within a warp
+// before updating the histogram (see warpAggregateRuns).  The sample
+// is copied to the host by the first exec of an engine only, and its
+// decision is kept for later execs; setting 'run_length_min' to zero
+// (or infinity) never pre-aggregates and skips the sample with its
+// synchronous copies altogether.
+//
+// When the histogram is split into many chunks, every chunk's kernel
+// would re-read the whole input and recompute 'f' only to discard the
+// elements of other chunks.  With 'partition_min_chunks' set, the
+// (index, value) pairs are instead partitioned by chunk once (see
+// partitionByChunk), and each chunk's kernel reads only its own
+// partition.
+//
+// Subhistograms are initialised with the descriptor's 'ne', not with
+// zero bytes, and never by a separate pass per 'exec': the local-memory
+// kernel initialises its shared-memory subhistograms in its prologue
+// and writes every bin of its global-memory subhistogram, and the
+// global-memory subhistograms are filled once at creation and restored
+// to 'ne' by the final reduction as it reads them.  Unlike the CPU
+// library, which tags tiles of its subhistograms with pass numbers and
+// initialises a tile only when a pass first touches it, the M*H bins
+// are still rewritten on every exec here: the reduction reads all of
+// them anyway, so the reset costs a coalesced write per bin but no
+// extra pass, whereas checking a tag would add a read, and for
+// 'atomicAdd' a CAS loop, to every scattered update.
 
 #pragma once
 
+#include "genhist-common.h"
+#include "genhist-trace.h"
+
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 #include <stdexcept>
+#include <string>
 #include <cstdint>
+#include <cstring>
 #include <cassert>
+#include <vector>
 
 namespace genhist {
 
-enum AtomicPrim {HDW, CAS, XCG};
-
-template<class T>
-struct indval {
-  uint32_t index;
-  T value;
-};
-
 // The three primitives for atomic update
 // AtomicAdd demonstrated on int32_t addition
 __device__ inline static uint32_t
@@ -84,48 +120,73 @@ atomXCG(volatile typename T::BETA* loc_hists, volatile int* loc_locks, uint32_t
   }
 }
 
-// Kernels for reducing across histograms (final stage)
+// Warp-level run-length pre-aggregation
+//
+// Shuffle a value of any type, one 32-bit word at a time.
+template<class T>
+__device__ inline static T
+shflDownAny(T v, int delta) {
+  const int words = (sizeof(T) + 3) / 4;
+  int32_t w[words];
+  memcpy(w, &v, sizeof(T));
+  for(int i = 0; i < words; i++) {
+    w[i] = __shfl_down_sync(0xffffffff, w[i], delta);
+  }
+  memcpy(&v, w, sizeof(T));
+  return v;
+}
+
+// The 32 lanes of a warp handle consecutive input elements.  Combine
+// the values of every run of lanes with the same 'index' into the
+// first lane of the run (with a segmented suffix scan over shuffles),
+// and return whether this lane is such a first lane, i.e. whether it
+// should update the histogram with 'v'.  Must be called by all lanes
+// of a full warp.
+template<class HP>
+__device__ inline static bool
+warpAggregateRuns(uint32_t index, typename HP::BETA& v) {
+  const unsigned int lane = threadIdx.x % 32;
+  const uint32_t prev = __shfl_up_sync(0xffffffff, index, 1);
+  const bool head = (lane == 0) || (prev != index);
+  const unsigned int heads = __ballot_sync(0xffffffff, head);
+  // the first head after this lane starts the next run
+  const unsigned int later = heads & ~((2u << lane) - 1);
+  const unsigned int run_end = later ? __ffs(later) - 2 : 31;
+  for(int delta = 1; delta < 32; delta *= 2) {
+    typename HP::BETA other = shflDownAny(v, delta);
+    if (lane + delta <= run_end)
+      v = HP::opScal(v, other);
+  }
+  return head;
+}
+
+// Kernels for reducing across histograms (final stage); with 'reset',
+// every subhistogram bin is set back to the neutral element once read,
+// and with 'fold', the result is combined with the contents of d_res.
 template<class T>
 __global__ void
-glbhist_reduce_kernel(typename T::BETA* d_his, typename T::BETA* d_res, int32_t his_sz, int32_t num_hists) {
+glbhist_reduce_kernel(typename T::BETA* d_his, typename T::BETA* d_res, int32_t his_sz, int32_t num_hists,
+                      bool reset, bool fold) {
   typedef typename T::BETA BETA;
   const unsigned int gid = blockIdx.x * blockDim.x + threadIdx.x;
   if(gid < his_sz) {
-    BETA sum = d_his[gid];
-    for(int i = gid+his_sz; i < num_hists*his_sz; i+=his_sz)
+    BETA sum = fold ? d_res[gid] : T::ne();
+    for(int i = gid; i < num_hists*his_sz; i+=his_sz) {
       sum = T::opScal(sum, d_his[i]);
+      if (reset)
+        d_his[i] = T::ne();
+    }
     d_res[gid] = sum;
   }
 }
 
-template<typename A, typename B>
-struct HistDescriptor {
-  // Input array element type.
-  typedef A ALPHA;
-
-  // Histogram element type.
-  typedef B BETA;
-
-  // Compute an (index,value) pair given an input element.
-  __device__ __host__ inline static
-  genhist::indval<BETA> f(const int32_t H, ALPHA pixel);
-
-  // Neutral element.
-  __device__ __host__ inline static
-  BETA ne();
-
-  // Apply binary operator.
-  __device__ __host__ inline static
-  BETA opScal(BETA v1, BETA v2);
-
-  // What kind of atomic strategy do we need?
-  __device__ __host__ inline static
-  genhist::AtomicPrim atomicKind();
-
-  // Apply binary operator atomically on memory location.
-  __device__ inline static
-  void opAtom(volatile BETA* hist, volatile int* locks, int32_t idx, BETA v);
-};
+// Set the n elements of 'd' to the neutral element.
+template<class T>
+__global__ void
+fillNeutralKernel(typename T::BETA* d, size_t n) {
+  for(size_t i = blockIdx.x * (size_t)blockDim.x + threadIdx.x; i < n; i += (size_t)gridDim.x * blockDim.x)
+    d[i] = T::ne();
+}
 
 // Local-Memory Histogram Computation Kernel
 //
@@ -137,7 +198,9 @@ struct HistDescriptor {
 // C is the cooperation level ceil(BLOCK/M)
 // T the number of used hardware threads, i.e., T = min(N, Thdw_max)
 // histos: the global-memory array to store the subhistogram result.
-template<class HP>
+// RUNS: whether to pre-aggregate runs of equal indices in each warp
+//   (the block size must then be a multiple of 32).
+template<class HP, bool RUNS>
 __global__ void
 locMemHdwAddCoopKernel( const int N, const int H
                         , const int M, const int T
@@ -171,7 +234,24 @@ locMemHdwAddCoopKernel( const int N, const int H
   }
 
   // compute local histograms
-  {
+  if (RUNS) {
+    // the whole warp iterates as long as its first lane does
+    int loop_count = (N - (int)(gid - tid % 32) + T - 1) / T;
+    for(int k=0; k<loop_count; k++) {
+      int i = gid + k*T;
+      uint32_t index = 0xffffffff;
+      BETA v = HP::ne();
+      if (i < N) {
+        struct indval<BETA> iv = HP::f(H, input[i]);
+        if (iv.index >= chunk_beg && iv.index < chunk_end) {
+          index = iv.index;
+          v = iv.value;
+        }
+      }
+      if (warpAggregateRuns<HP>(index, v) && index != 0xffffffff)
+        HP::opAtom(loc_hists, loc_locks, lhid+index-chunk_beg, v);
+    }
+  } else {
     // Loop was normalized so one can unroll
     int loop_count = (N - gid + T - 1) / T;
     for(int k=0; k<loop_count; k++) {
@@ -196,7 +276,7 @@ locMemHdwAddCoopKernel( const int N, const int H
 }
 
 // Global-Memory Histogram Computation Kernel
-template<class HP>
+template<class HP, bool RUNS>
 __global__ void
 glbMemHdwAddCoopKernel( const int N, const int H,
                         const int M, const int T,
@@ -210,19 +290,141 @@ glbMemHdwAddCoopKernel( const int N, const int H,
   int C = (T + M - 1) / M;
   int ghidx = (gid / C) * H;
   // compute histograms; assumes histograms have been previously initialized
-  for(int i=gid; i<N; i+=T) {
-    struct indval<BETA> iv = HP::f(H, input[i]);
-    if (iv.index >= chunk_beg && iv.index < chunk_end)
-      HP::opAtom(histos, locks, ghidx+iv.index, iv.value);
+  if (RUNS) {
+    // the whole warp iterates as long as its first lane does
+    for(int i0=gid - threadIdx.x % 32; i0<N; i0+=T) {
+      const int i = i0 + threadIdx.x % 32;
+      uint32_t index = 0xffffffff;
+      BETA v = HP::ne();
+      if (i < N) {
+        struct indval<BETA> iv = HP::f(H, input[i]);
+        if (iv.index >= chunk_beg && iv.index < chunk_end) {
+          index = iv.index;
+          v = iv.value;
+        }
+      }
+      if (warpAggregateRuns<HP>(index, v) && index != 0xffffffff)
+        HP::opAtom(histos, locks, ghidx+index, v);
+    }
+  } else {
+    for(int i=gid; i<N; i+=T) {
+      struct indval<BETA> iv = HP::f(H, input[i]);
+      if (iv.index >= chunk_beg && iv.index < chunk_end)
+        HP::opAtom(histos, locks, ghidx+iv.index, iv.value);
+    }
+  }
+}
+
+// Partitioning by chunk
+//
+// The descriptor of an input that has already been mapped by HP::f:
+// its elements are the (index, value) pairs themselves.
+template<class HP>
+struct PartitionedHist {
+  typedef indval<typename HP::BETA> ALPHA;
+  typedef typename HP::BETA BETA;
+
+  __device__ __host__ inline static
+  indval<BETA> f(const int32_t H, ALPHA iv) { return iv; }
+
+  __device__ __host__ inline static
+  BETA ne() { return HP::ne(); }
+
+  __device__ __host__ inline static
+  BETA opScal(BETA v1, BETA v2) { return HP::opScal(v1, v2); }
+
+  __device__ __host__ inline static
+  AtomicPrim atomicKind() { return HP::atomicKind(); }
+
+  __device__ inline static
+  void opAtom(volatile BETA* hist, volatile int* locks, int32_t idx, BETA v) {
+    HP::opAtom(hist, locks, idx, v);
+  }
+};
+
+// Count the input elements whose index falls in each chunk of Hchunk
+// bins; 'counts' must be zeroed.  Needs num_chunks ints of shared memory.
+template<class HP>
+__global__ void
+partitionCountKernel( const int N, const int H, const int Hchunk, const int num_chunks
+                    , typename HP::ALPHA* input
+                    , int* counts
+                    ) {
+  extern __shared__ int loc_counts[];
+  for(int c = threadIdx.x; c < num_chunks; c += blockDim.x)
+    loc_counts[c] = 0;
+  __syncthreads();
+  for(int i = blockIdx.x * blockDim.x + threadIdx.x; i < N; i += gridDim.x * blockDim.x) {
+    const uint32_t index = HP::f(H, input[i]).index;
+    if (index < (uint32_t)H)
+      atomicAdd(&loc_counts[index / Hchunk], 1);
+  }
+  __syncthreads();
+  for(int c = threadIdx.x; c < num_chunks; c += blockDim.x)
+    if (loc_counts[c] > 0)
+      atomicAdd(&counts[c], loc_counts[c]);
+}
+
+// Write the (index, value) pair of every input element to the
+// partition of its chunk.  'cursors' initially holds the start of each
+// partition.  Each round of blockDim.x elements reserves space for the
+// whole block with one global atomic per chunk.  Needs 2*num_chunks
+// ints of shared memory.
+template<class HP>
+__global__ void
+partitionScatterKernel( const int N, const int H, const int Hchunk, const int num_chunks
+                      , typename HP::ALPHA* input
+                      , int* cursors
+                      , indval<typename HP::BETA>* parts
+                      ) {
+  typedef typename HP::BETA BETA;
+  extern __shared__ int loc_part[];
+  int* loc_counts = loc_part;
+  int* loc_base   = loc_part + num_chunks;
+  for(int i0 = blockIdx.x * blockDim.x; i0 < N; i0 += gridDim.x * blockDim.x) {
+    for(int c = threadIdx.x; c < num_chunks; c += blockDim.x)
+      loc_counts[c] = 0;
+    __syncthreads();
+    const int i = i0 + threadIdx.x;
+    struct indval<BETA> iv;
+    int chunk = -1, offset = 0;
+    if (i < N) {
+      iv = HP::f(H, input[i]);
+      if (iv.index < (uint32_t)H) {
+        chunk  = iv.index / Hchunk;
+        offset = atomicAdd(&loc_counts[chunk], 1);
+      }
+    }
+    __syncthreads();
+    for(int c = threadIdx.x; c < num_chunks; c += blockDim.x)
+      if (loc_counts[c] > 0)
+        loc_base[c] = atomicAdd(&cursors[c], loc_counts[c]);
+    __syncthreads();
+    if (chunk >= 0)
+      parts[loc_base[chunk] + offset] = iv;
+    __syncthreads();
   }
 }
 
+// The most chunks that partitioning supports (bounded by the shared
+// memory for per-chunk counters).
+const int partition_chunks_max = 2048;
+
 template<class T>
 inline void
-reduceAcrossMultiHistos(uint32_t H, uint32_t M, uint32_t B, typename T::BETA* d_histos, typename T::BETA* d_histo) {
+reduceAcrossMultiHistos(uint32_t H, uint32_t M, uint32_t B, typename T::BETA* d_histos, typename T::BETA* d_histo,
+                        bool reset = false, bool fold = false) {
   // reduce across subhistograms
   const size_t num_blocks_red = (H + B - 1) / B;
-  glbhist_reduce_kernel<T><<< num_blocks_red, B >>>(d_histos, d_histo, H, M);
+  glbhist_reduce_kernel<T><<< num_blocks_red, B >>>(d_histos, d_histo, H, M, reset, fold);
+}
+
+template<class T>
+inline void
+fillNeutral(typename T::BETA* d, size_t n) {
+  const int B = 256;
+  const size_t num_blocks = std::max((size_t)1, std::min((n + B - 1) / B, (size_t)4096));
+  fillNeutralKernel<T><<< num_blocks, B >>>(d, n);
 }
 
 struct GenHistConfig
@@ -234,15 +436,18 @@ struct GenHistConfig
   const int sharedMemWordsPerThread;
   const int glb_k_min;
   const int gpu_id;
+  const size_t mem_budget; // bytes of device memory; zero means no limit
+  const int partition_min_chunks; // partition the input by chunk from this many chunks; zero means never
+  const float run_length_min; // pre-aggregate runs from this sampled average length; zero or infinity means never
 };
 
-const GenHistConfig rtx2080{ 0.75, 0.4, 4096*1024, 16, 12, 2, 0 };
+const GenHistConfig rtx2080{ 0.75, 0.4, 4096*1024, 16, 12, 2, 0, 0, 0, run_length_min };
 
 template<class HP>
 class GenHist
 {
 public:
-  GenHist(int gpu_id) {
+  GenHist(int gpu_id) : gpu_id(gpu_id), tracer(NULL), phases_ts(0), runs_sampled(false), runs(false) {
     int32_t nDevices;
     cudaGetDeviceCount(&nDevices);
 
@@ -254,10 +459,71 @@ public:
   }
 
   virtual void exec(typename HP::ALPHA* d_input) = 0;
+  virtual void execInto(typename HP::BETA* d_dest, typename HP::ALPHA* d_input) = 0;
   virtual const typename HP::BETA* result() const = 0;
 
+  // Record the kernels of subsequent execs on 't' (see
+  // genhist-trace.h), and the host-side sampling on track 0; NULL stops
+  // tracing.  A traced exec waits for its kernels to finish.
+  void setTracer(Tracer* t) {
+    tracer = t;
+    if (t) {
+      t->nameTrack(gpu_track + gpu_id, "GPU " + std::to_string(gpu_id));
+    }
+  }
+
+  // The track of the kernels of GPU 0 (GPU i uses gpu_track + i).
+  static const int gpu_track = 1000;
+
 protected:
 
+  // Kernels are timed with CUDA events and recorded on the tracer when
+  // the exec ends, relative to the host time at which the first one
+  // was launched.
+  struct Phase {
+    const char* name;
+    const char* arg_name;
+    int64_t arg;
+    cudaEvent_t beg, end;
+  };
+
+  void phaseBegin(const char* name, const char* arg_name = NULL, int64_t arg = 0) {
+    if (!tracer) {
+      return;
+    }
+    if (phases.empty()) {
+      phases_ts = tracer->now();
+    }
+    Phase p = { name, arg_name, arg, NULL, NULL };
+    cudaEventCreate(&p.beg);
+    cudaEventCreate(&p.end);
+    cudaEventRecord(p.beg);
+    phases.push_back(p);
+  }
+
+  void phaseEnd() {
+    if (tracer) {
+      cudaEventRecord(phases.back().end);
+    }
+  }
+
+  void flushPhases() {
+    if (!tracer || phases.empty()) {
+      return;
+    }
+    cudaEventSynchronize(phases.back().end);
+    for (size_t i = 0; i < phases.size(); i++) {
+      float since = 0, dur = 0;
+      cudaEventElapsedTime(&since, phases[0].beg, phases[i].beg);
+      cudaEventElapsedTime(&dur, phases[i].beg, phases[i].end);
+      tracer->record(phases[i].name, "genhist", gpu_track + gpu_id, phases_ts + 1000.0 * since,
+                     1000.0 * dur, phases[i].arg_name, phases[i].arg);
+      cudaEventDestroy(phases[i].beg);
+      cudaEventDestroy(phases[i].end);
+    }
+    phases.clear();
+  }
+
   inline int numThreads(int n) const {
     return std::min(n, getHDW());
   }
@@ -274,7 +540,78 @@ protected:
     return gpu_props.sharedMemPerBlock;
   }
 
+  // Sample the average run length of equal indices in the input, by
+  // copying a few small windows of it to the host.
+  float sampleRunLength(typename HP::ALPHA* d_input, int N, int H) const {
+    typedef typename HP::ALPHA ALPHA;
+    const int windows = 8, width = 512;
+    std::vector<ALPHA> sample;
+    if (N <= windows * width) {
+      sample.resize(N);
+      cudaMemcpy(sample.data(), d_input, N * sizeof(ALPHA), cudaMemcpyDeviceToHost);
+      return genhist::sampleRunLength(HP(), H, N, [&](int64_t i) { return sample[i]; }, 1, N);
+    }
+    sample.resize(windows * width);
+    for(int w = 0; w < windows; w++) {
+      cudaMemcpy(sample.data() + w * width, d_input + (int64_t)N * w / windows,
+                 width * sizeof(ALPHA), cudaMemcpyDeviceToHost);
+    }
+    return genhist::sampleRunLength(HP(), H, windows * width,
+                                    [&](int64_t i) { return sample[i]; }, windows, width);
+  }
+
+  // Whether to pre-aggregate runs of equal indices.  Decided by the
+  // first call, from a sample of that input, and remembered, so that
+  // later execs do not wait for the copies.
+  bool preAggregate(typename HP::ALPHA* d_input, int N, int H, float min_length) {
+    if (!(min_length > 0) || std::isinf(min_length)) {
+      return false;
+    }
+    if (!runs_sampled) {
+      TraceScope scope(tracer, "sample", "genhist", 0);
+      runs = sampleRunLength(d_input, N, H) >= min_length;
+      runs_sampled = true;
+    }
+    return runs;
+  }
+
+  // Whether to partition an input of N elements by chunk, given the
+  // device memory already used and the budget.
+  static bool wantPartition(const GenHistConfig& consts, int N, int num_chunks, size_t used) {
+    const size_t bytes = (size_t)N * sizeof(indval<typename HP::BETA>) + num_chunks * sizeof(int);
+    return consts.partition_min_chunks > 0 && num_chunks >= consts.partition_min_chunks &&
+      num_chunks <= partition_chunks_max &&
+      (consts.mem_budget == 0 || used + bytes <= consts.mem_budget);
+  }
+
+  // Partition the (index, value) pairs of the N input elements into
+  // d_parts by chunks of Hchunk bins, with one pass over the input for
+  // counting and one for scattering.  On return, the partition of
+  // chunk k is d_parts[starts[k]] to d_parts[starts[k+1]-1].
+  void partitionByChunk(typename HP::ALPHA* d_input, int N, int H, int Hchunk, int num_chunks,
+                        indval<typename HP::BETA>* d_parts, int* d_cursors,
+                        std::vector<int>& starts) const {
+    const int B = 256;
+    const int num_blocks = std::max(1, std::min((N + B - 1) / B, getHDW() / B));
+    cudaMemset(d_cursors, 0, num_chunks * sizeof(int));
+    partitionCountKernel<HP><<< num_blocks, B, num_chunks * sizeof(int) >>>
+      (N, H, Hchunk, num_chunks, d_input, d_cursors);
+    starts.resize(num_chunks + 1);
+    cudaMemcpy(starts.data() + 1, d_cursors, num_chunks * sizeof(int), cudaMemcpyDeviceToHost);
+    starts[0] = 0;
+    for(int k = 0; k < num_chunks; k++)
+      starts[k+1] += starts[k];
+    cudaMemcpy(d_cursors, starts.data(), num_chunks * sizeof(int), cudaMemcpyHostToDevice);
+    partitionScatterKernel<HP><<< num_blocks, B, 2 * num_chunks * sizeof(int) >>>
+      (N, H, Hchunk, num_chunks, d_input, d_cursors, d_parts);
+  }
+
   cudaDeviceProp gpu_props;
+  const int gpu_id;
+  Tracer* tracer;
+  std::vector<Phase> phases;
+  double phases_ts;
+  bool runs_sampled, runs; // see preAggregate
 };
 
 template<class HP>
@@ -282,13 +619,41 @@ class LocalMemoryGenHist : public GenHist<HP>
 {
 public:
   LocalMemoryGenHist(GenHistConfig consts, int H, int N)
-    : GenHist<HP>(consts.gpu_id), H(H), N(N), consts(consts) {
+    : LocalMemoryGenHist(consts, H, N, true) { }
+
+  // Bytes of device memory that an instance with these arguments
+  // would allocate, taking consts.mem_budget into account.
+  static size_t bytesRequired(GenHistConfig consts, int H, int N) {
+    return LocalMemoryGenHist(consts, H, N, false).bytesAllocated();
+  }
+
+  size_t bytesAllocated() const {
+    return (size_t)(num_blocks + 1) * H * sizeof(typename HP::BETA) + partitionBytes();
+  }
+
+  // Whether exec partitions the input by chunk.
+  bool partitioned() const { return partition; }
+
+private:
+  LocalMemoryGenHist(GenHistConfig consts, int H, int N, bool alloc)
+    : GenHist<HP>(consts.gpu_id), H(H), N(N), consts(consts), partition(false),
+      d_histos(NULL), d_histo(NULL), d_parts(NULL), d_cursors(NULL) {
     typedef typename HP::BETA BETA;
     const AtomicPrim prim_kind = HP::atomicKind();
     const int32_t BLOCK = GenHist<HP>::gpu_props.maxThreadsPerBlock;
 
     const int32_t lmem = consts.sharedMemWordsPerThread * BLOCK * 4;
     num_blocks = (GenHist<HP>::numThreads(N) + BLOCK - 1) / BLOCK;
+    // every block has a subhistogram in global memory: use fewer
+    // blocks (each processing more elements) to fit the budget
+    if (consts.mem_budget > 0) {
+      const size_t histo_bytes = (size_t)H * sizeof(BETA);
+      if (consts.mem_budget < 2 * histo_bytes) {
+        throw std::runtime_error("LocalMemoryGenHist: memory budget is too small");
+      }
+      num_blocks = std::min((size_t)num_blocks, consts.mem_budget / histo_bytes - 1);
+    }
+    T = std::min(GenHist<HP>::numThreads(N), num_blocks * BLOCK);
     const int32_t q_small = 2;
     const int32_t work_asymp_M_max = N / (q_small*num_blocks*H);
 
@@ -303,51 +668,106 @@ public:
     const int32_t len = lmem / (el_size * M);
     num_chunks = (H + len - 1) / len;
 
-    const size_t mem_size_histo  = H * sizeof(BETA);
-    const size_t mem_size_histos = num_blocks * mem_size_histo;
-    cudaMalloc((void**) &d_histos, mem_size_histos);
-    cudaMalloc((void**) &d_histo,  mem_size_histo);
-    cudaMemset(d_histo, 0, mem_size_histo);
-
     const int32_t Hchunk = (H + num_chunks - 1) / num_chunks;
     shmem_size = M * Hchunk * el_size;
+    partition = GenHist<HP>::wantPartition(consts, N, num_chunks, bytesAllocated());
+
+    if (alloc) {
+      const size_t mem_size_histo  = H * sizeof(BETA);
+      const size_t mem_size_histos = num_blocks * mem_size_histo;
+      cudaMalloc((void**) &d_histos, mem_size_histos);
+      cudaMalloc((void**) &d_histo,  mem_size_histo);
+      fillNeutral<HP>(d_histo, H);
+      if (partition) {
+        cudaMalloc((void**) &d_parts,   (size_t)N * sizeof(indval<BETA>));
+        cudaMalloc((void**) &d_cursors, num_chunks * sizeof(int));
+      }
+    }
   }
 
+  size_t partitionBytes() const {
+    return partition ? (size_t)N * sizeof(indval<typename HP::BETA>) + num_chunks * sizeof(int) : 0;
+  }
+
+public:
+
   ~LocalMemoryGenHist() {
     cudaFree(d_histos);
     cudaFree(d_histo);
+    cudaFree(d_parts);
+    cudaFree(d_cursors);
   }
 
   void exec(typename HP::ALPHA* d_input) {
-    typedef typename HP::BETA BETA;
+    run(d_input, d_histo, false);
+  }
+
+  // Fold the histogram of d_input into the H bins of d_dest.
+  void execInto(typename HP::BETA* d_dest, typename HP::ALPHA* d_input) {
+    run(d_input, d_dest, true);
+  }
+
+  const typename HP::BETA* result() const {
+    return d_histo;
+  }
+
+private:
+  void run(typename HP::ALPHA* d_input, typename HP::BETA* d_out, bool fold) {
     const int32_t BLOCK  = GenHist<HP>::gpu_props.maxThreadsPerBlock;
     const int32_t Hchunk = (H + num_chunks - 1) / num_chunks;
 
-    const size_t mem_size_histo  = H * sizeof(BETA);
-    const size_t mem_size_histos = num_blocks * mem_size_histo;
+    // d_histos needs no initialisation: every block writes all bins
+    // of its subhistogram
+    if (partition) {
+      // partitions are not in input order, so runs are not detected
+      std::vector<int> starts;
+      GenHist<HP>::phaseBegin("partition", "chunks", num_chunks);
+      GenHist<HP>::partitionByChunk(d_input, N, H, Hchunk, num_chunks, d_parts, d_cursors, starts);
+      GenHist<HP>::phaseEnd();
+      for(int k=0; k<num_chunks; k++) {
+        GenHist<HP>::phaseBegin("chunk", "chunk", k);
+        locMemHdwAddCoopKernel<PartitionedHist<HP>, false><<< num_blocks, BLOCK, shmem_size >>>
+          (starts[k+1] - starts[k], H, M, T, k*Hchunk, min(H, (k+1)*Hchunk),
+           d_parts + starts[k], d_histos);
+        GenHist<HP>::phaseEnd();
+      }
+      GenHist<HP>::phaseBegin("reduce", "subhistograms", num_blocks);
+      reduceAcrossMultiHistos<HP>(H, num_blocks, 256, d_histos, d_out, false, fold);
+      GenHist<HP>::phaseEnd();
+      GenHist<HP>::flushPhases();
+      return;
+    }
 
-    cudaMemset(d_histos, 0, mem_size_histos);
+    const bool runs = GenHist<HP>::preAggregate(d_input, N, H, consts.run_length_min);
     for(int k=0; k<num_chunks; k++) {
       const int32_t chunkLB = k*Hchunk;
       const int32_t chunkUB = min(H, (k+1)*Hchunk);
 
-      locMemHdwAddCoopKernel<HP><<< num_blocks, BLOCK, shmem_size >>>
-        (N, H, M, GenHist<HP>::numThreads(N), chunkLB, chunkUB, d_input, d_histos);
+      GenHist<HP>::phaseBegin("chunk", "chunk", k);
+      if (runs) {
+        locMemHdwAddCoopKernel<HP, true><<< num_blocks, BLOCK, shmem_size >>>
+          (N, H, M, T, chunkLB, chunkUB, d_input, d_histos);
+      } else {
+        locMemHdwAddCoopKernel<HP, false><<< num_blocks, BLOCK, shmem_size >>>
+          (N, H, M, T, chunkLB, chunkUB, d_input, d_histos);
+      }
+      GenHist<HP>::phaseEnd();
     }
 
     // reduce across histograms
-    reduceAcrossMultiHistos<HP>(H, num_blocks, 256, d_histos, d_histo);
+    GenHist<HP>::phaseBegin("reduce", "subhistograms", num_blocks);
+    reduceAcrossMultiHistos<HP>(H, num_blocks, 256, d_histos, d_out, false, fold);
+    GenHist<HP>::phaseEnd();
+    GenHist<HP>::flushPhases();
   }
 
-  const typename HP::BETA* result() const {
-    return d_histo;
-  }
-
-private:
   const GenHistConfig consts;
-  int H, N, M, num_chunks, num_blocks;
+  int H, N, M, T, num_chunks, num_blocks;
+  bool partition;
   typename HP::BETA* d_histos;
   typename HP::BETA* d_histo;
+  indval<typename HP::BETA>* d_parts;
+  int* d_cursors;
   size_t shmem_size;
 };
 
@@ -356,7 +776,27 @@ class GlobalMemoryGenHist : public GenHist<HP>
 {
 public:
   GlobalMemoryGenHist(GenHistConfig consts, int B, int RF, int H, int N)
-    : GenHist<HP>(consts.gpu_id), B(B), RF(RF), H(H), N(N), consts(consts) {
+    : GlobalMemoryGenHist(consts, B, RF, H, N, true) { }
+
+  // Bytes of device memory that an instance with these arguments
+  // would allocate, taking consts.mem_budget into account.
+  static size_t bytesRequired(GenHistConfig consts, int B, int RF, int H, int N) {
+    return GlobalMemoryGenHist(consts, B, RF, H, N, false).bytesAllocated();
+  }
+
+  size_t bytesAllocated() const {
+    const size_t lock_size = HP::atomicKind() == XCG ? sizeof(int32_t) : 0;
+    return (size_t)M * H * (sizeof(typename HP::BETA) + lock_size)
+      + (size_t)H * sizeof(typename HP::BETA) + partitionBytes();
+  }
+
+  // Whether exec partitions the input by chunk.
+  bool partitioned() const { return partition; }
+
+private:
+  GlobalMemoryGenHist(GenHistConfig consts, int B, int RF, int H, int N, bool alloc)
+    : GenHist<HP>(consts.gpu_id), B(B), RF(RF), H(H), N(N), consts(consts),
+      partition(false), d_histos(NULL), d_histo(NULL), d_locks(NULL), d_parts(NULL), d_cursors(NULL) {
     const int32_t T = GenHist<HP>::numThreads(N);
     typedef typename HP::BETA BETA;
     const AtomicPrim prim_kind = HP::atomicKind();
@@ -384,57 +824,123 @@ public:
     const float coop = std::min( (float)T, (u * H_chk) / k_max );
     M = max( 1, (int)floor(T/coop) );
 
+    // fewer subhistograms (hence more cooperation) to fit the budget
+    if (consts.mem_budget > 0 && bytesAllocated() > consts.mem_budget) {
+      const size_t per_sub = (size_t)H * el_size;
+      const size_t result  = (size_t)H * sizeof(BETA);
+      if (consts.mem_budget < result + per_sub) {
+        throw std::runtime_error("GlobalMemoryGenHist: memory budget is too small for a single subhistogram");
+      }
+      M = std::min((size_t)M, (consts.mem_budget - result) / per_sub);
+    }
+
     const int32_t C = (T + M - 1) / M;
     assert((C > 0) && (C <= T));
+    partition = GenHist<HP>::wantPartition(consts, N, num_chunks, bytesAllocated());
+
+    if (!alloc) {
+      return;
+    }
 
     const size_t mem_size_histo  = H * sizeof(BETA);
     const size_t mem_size_histos = M * mem_size_histo;
     cudaMalloc((void**) &d_histos, mem_size_histos);
     cudaMalloc((void**) &d_histo,  mem_size_histo );
-    cudaMemset(d_histo,  0, mem_size_histo );
+    // the reduction in exec restores the subhistograms to this state
+    fillNeutral<HP>(d_histos, (size_t)M * H);
+    fillNeutral<HP>(d_histo, H);
 
     if (prim_kind == XCG) {
       const size_t mem_size_locks = M * H * sizeof(int32_t);
       cudaMalloc((void**) &d_locks, mem_size_locks);
       cudaMemset(d_locks,  0, mem_size_locks );
-    } else {
-      d_locks = NULL;
     }
+    if (partition) {
+      cudaMalloc((void**) &d_parts,   (size_t)N * sizeof(indval<BETA>));
+      cudaMalloc((void**) &d_cursors, num_chunks * sizeof(int));
+    }
+  }
+
+  size_t partitionBytes() const {
+    return partition ? (size_t)N * sizeof(indval<typename HP::BETA>) + num_chunks * sizeof(int) : 0;
   }
 
+public:
+
   ~GlobalMemoryGenHist() {
     cudaFree(d_histos);
     cudaFree(d_histo);
     cudaFree(d_locks);
+    cudaFree(d_parts);
+    cudaFree(d_cursors);
   }
 
   void exec(typename HP::ALPHA* d_input) {
-    typedef typename HP::BETA BETA;
+    run(d_input, d_histo, false);
+  }
+
+  // Fold the histogram of d_input into the H bins of d_dest.
+  void execInto(typename HP::BETA* d_dest, typename HP::ALPHA* d_input) {
+    run(d_input, d_dest, true);
+  }
+
+  const typename HP::BETA* result() const {
+    return d_histo;
+  }
+
+private:
+  void run(typename HP::ALPHA* d_input, typename HP::BETA* d_out, bool fold) {
     const int32_t T = GenHist<HP>::numThreads(N);
     const int32_t chunk_size = (H + num_chunks - 1) / num_chunks;
     const int32_t num_blocks = (T + B - 1) / B;
 
-    const size_t mem_size_histos = M * H * sizeof(BETA);
-    cudaMemset(d_histos, 0, mem_size_histos);
+    if (partition) {
+      // partitions are not in input order, so runs are not detected
+      std::vector<int> starts;
+      GenHist<HP>::phaseBegin("partition", "chunks", num_chunks);
+      GenHist<HP>::partitionByChunk(d_input, N, H, chunk_size, num_chunks, d_parts, d_cursors, starts);
+      GenHist<HP>::phaseEnd();
+      for(int k=0; k<num_chunks; k++) {
+        GenHist<HP>::phaseBegin("chunk", "chunk", k);
+        glbMemHdwAddCoopKernel<PartitionedHist<HP>, false><<< num_blocks, B >>>
+          (starts[k+1] - starts[k], H, M, T, k*chunk_size, (k+1)*chunk_size,
+           d_parts + starts[k], d_histos, d_locks);
+        GenHist<HP>::phaseEnd();
+      }
+      GenHist<HP>::phaseBegin("reduce", "subhistograms", M);
+      reduceAcrossMultiHistos<HP>(H, M, B, d_histos, d_out, true, fold);
+      GenHist<HP>::phaseEnd();
+      GenHist<HP>::flushPhases();
+      return;
+    }
 
-    // compute histogram
+    // compute histogram, pre-aggregating runs if the block size allows
+    const bool runs = B % 32 == 0 && GenHist<HP>::preAggregate(d_input, N, H, consts.run_length_min);
     for(int k=0; k<num_chunks; k++) {
-      glbMemHdwAddCoopKernel<HP><<< num_blocks, B >>>
-        (N, H, M, T, k*chunk_size, (k+1)*chunk_size, d_input, d_histos, d_locks);
+      GenHist<HP>::phaseBegin("chunk", "chunk", k);
+      if (runs) {
+        glbMemHdwAddCoopKernel<HP, true><<< num_blocks, B >>>
+          (N, H, M, T, k*chunk_size, (k+1)*chunk_size, d_input, d_histos, d_locks);
+      } else {
+        glbMemHdwAddCoopKernel<HP, false><<< num_blocks, B >>>
+          (N, H, M, T, k*chunk_size, (k+1)*chunk_size, d_input, d_histos, d_locks);
+      }
+      GenHist<HP>::phaseEnd();
     }
-    // reduce across subhistograms
-    reduceAcrossMultiHistos<HP>(H, M, B, d_histos, d_histo);
+    // reduce across subhistograms, and reinitialise them for the next exec
+    GenHist<HP>::phaseBegin("reduce", "subhistograms", M);
+    reduceAcrossMultiHistos<HP>(H, M, B, d_histos, d_out, true, fold);
+    GenHist<HP>::phaseEnd();
+    GenHist<HP>::flushPhases();
   }
 
-  const typename HP::BETA* result() const {
-    return d_histo;
-  }
-
-private:
   int RF, H, N, M, num_chunks, B;
+  bool partition;
   typename HP::BETA* d_histos;
   typename HP::BETA* d_histo;
   int32_t*           d_locks;
+  indval<typename HP::BETA>* d_parts;
+  int*               d_cursors;
   const GenHistConfig consts;
 };
 
@@ -0,0 +1,124 @@
+// Computes an integer-addition histogram over a file of raw int32
+// elements, without ever holding more than a few blocks of the file
+// in memory.  The file may be larger than main memory.
+//
+// Usage: stream-histo FILE H [block MiB] [header bytes | fut]
+//
+// With 'fut', FILE is read as a Futhark binary data file and the
+// first value (which must be a one-dimensional i32 array) is used.
+//
+// Use 'stream-histo --generate FILE N' to write N random elements to
+// FILE for testing.
+
+#include "genhist-stream.h"
+#include "futhark-data.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+struct AddI32 : genhist::HistDescriptor<int32_t, int32_t> {
+  inline static
+  genhist::indval<BETA> f(const int32_t H, ALPHA pixel) {
+    genhist::indval<BETA> res;
+    res.index = ((uint32_t)pixel) % H;
+    res.value = 1;
+    return res;
+  }
+
+  inline static
+  BETA ne() { return 0; }
+
+  inline static
+  BETA opScal(BETA v1, BETA v2) {
+    return v1 + v2;
+  }
+
+  inline static
+  genhist::AtomicPrim atomicKind() { return genhist::HDW; }
+};
+
+void usage(const char *prog) {
+  fprintf(stderr, "Usage: %s FILE H [block MiB] [header bytes | fut]\n", prog);
+  fprintf(stderr, "       %s --generate FILE N\n", prog);
+  exit(1);
+}
+
+int generate(const char *path, int64_t n) {
+  FILE* f = fopen(path, "wb");
+  if (f == NULL) {
+    fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+    return 1;
+  }
+  srand(2006);
+  const int64_t buf_len = 1 << 20;
+  int32_t* buf = (int32_t*) malloc(buf_len * sizeof(int32_t));
+  for (int64_t i = 0; i < n; i += buf_len) {
+    const int64_t m = std::min(buf_len, n - i);
+    for (int64_t j = 0; j < m; j++) {
+      buf[j] = rand();
+    }
+    fwrite(buf, sizeof(int32_t), m, f);
+  }
+  free(buf);
+  fclose(f);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  if (argc == 4 && strcmp(argv[1], "--generate") == 0) {
+    return generate(argv[2], atoll(argv[3]));
+  }
+  if (argc < 3 || argc > 5) {
+    usage(argv[0]);
+  }
+
+  const int H = atoi(argv[2]);
+  const size_t block_bytes = (argc > 3 ? atoll(argv[3]) : 64) * 1024 * 1024;
+  int64_t offset = 0;
+  int64_t length = -1;
+  if (H <= 0) {
+    usage(argv[0]);
+  }
+  if (argc > 4 && strcmp(argv[4], "fut") != 0) {
+    offset = atoll(argv[4]);
+  } else if (argc > 4) {
+    genhist::FutharkDataFile fut(argv[1]);
+    if (fut.size() == 0 || fut[0].shape.size() != 1) {
+      fprintf(stderr, "%s: expected a one-dimensional array\n", argv[1]);
+      return 1;
+    }
+    fut[0].as<int32_t>();
+    offset = fut[0].offset;
+    length = fut[0].numBytes();
+  }
+
+  genhist::StreamConfig cfg{ block_bytes, genhist::stream_default.depth, offset, length,
+                             genhist::stream_default.pages };
+  genhist::HostGenHist<AddI32> hist(genhist::host_default, 1, H, block_bytes / sizeof(int32_t));
+
+  struct timeval t_start, t_end;
+  gettimeofday(&t_start, NULL);
+  const int64_t n = genhist::streamHisto(hist, argv[1], cfg);
+  gettimeofday(&t_end, NULL);
+  const double secs = (t_end.tv_sec - t_start.tv_sec) + (t_end.tv_usec - t_start.tv_usec) / 1e6;
+
+  int64_t total = 0;
+  for (int i = 0; i < H; i++) {
+    total += hist.result()[i];
+  }
+  if (total != n) {
+    fprintf(stderr, "Validation FAILS: %lld elements, %lld counted\n",
+            (long long)n, (long long)total);
+    return 3;
+  }
+
+  // (bound by the storage the file comes from, not by memory, so there
+  // is no STREAM bandwidth to compare with)
+  printf("%lld elements in %.3f s: %.1f MB/s (subhistograms on %s, %.1f MiB of %.1f MiB huge)\n",
+         (long long)n, secs, n * sizeof(int32_t) / secs / 1e6,
+         genhist::pagePolicyName(hist.pagePolicy()), hist.hugeBytes() / 1048576.0,
+         hist.bytesAllocated() / 1048576.0);
+  return 0;
+}
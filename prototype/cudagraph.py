@@ -1,6 +1,7 @@
 #!/usr/bin/env python3
 
 import sys
+import os
 import csv
 import numpy as np
 import re
@@ -33,21 +34,24 @@ def plot_lib(ax, f, mem, style):
                     linewidth=w,
                     label='{} ({})'.format(label, mem))
 
-_, outputfile = sys.argv
-
-hdw_shared_1_file='hdw_local_1.csv'
-hdw_global_1_file='hdw_global_1.csv'
-cas_shared_1_file='cas_local_1.csv'
-cas_global_1_file='cas_global_1.csv'
-xcg_shared_1_file='xcg_local_1.csv'
-xcg_global_1_file='xcg_global_1.csv'
-
-hdw_shared_63_file='hdw_local_63.csv'
-hdw_global_63_file='hdw_global_63.csv'
-cas_shared_63_file='cas_local_63.csv'
-cas_global_63_file='cas_global_63.csv'
-xcg_shared_63_file='xcg_local_63.csv'
-xcg_global_63_file='xcg_global_63.csv'
+# The CSVs are read from the current directory, or from the directory
+# given after the output file (such as 'host' for the CPU sweep).
+outputfile = sys.argv[1]
+datadir = sys.argv[2] if len(sys.argv) > 2 else '.'
+
+hdw_shared_1_file=os.path.join(datadir, 'hdw_local_1.csv')
+hdw_global_1_file=os.path.join(datadir, 'hdw_global_1.csv')
+cas_shared_1_file=os.path.join(datadir, 'cas_local_1.csv')
+cas_global_1_file=os.path.join(datadir, 'cas_global_1.csv')
+xcg_shared_1_file=os.path.join(datadir, 'xcg_local_1.csv')
+xcg_global_1_file=os.path.join(datadir, 'xcg_global_1.csv')
+
+hdw_shared_63_file=os.path.join(datadir, 'hdw_local_63.csv')
+hdw_global_63_file=os.path.join(datadir, 'hdw_global_63.csv')
+cas_shared_63_file=os.path.join(datadir, 'cas_local_63.csv')
+cas_global_63_file=os.path.join(datadir, 'cas_global_63.csv')
+xcg_shared_63_file=os.path.join(datadir, 'xcg_local_63.csv')
+xcg_global_63_file=os.path.join(datadir, 'xcg_global_63.csv')
 
 fig, axes = plt.subplots(2,3, figsize=(10,5))
 plt.subplots_adjust(hspace=0.3)
@@ -0,0 +1,449 @@
+// The design-space sweep of histo-main.cu, on the CPU.  For the same
+// histogram sizes, subhistogram degrees and race factor, it times the
+// HDW, CAS and XCG histograms of the multicore library
+// (../library/genhist-host.h) with M fixed, and with the M and number
+// of chunks of its cost model ("Auto"), and writes CSVs in the format
+// that cudagraph.py plots.
+//
+// A CPU has no shared memory, so "local" and "global" only select the
+// histogram sizes and degrees of the two GPU sweeps.  In the local
+// sweep, the block of BLOCK threads becomes the T threads of the
+// library's pool: the degree k*BLOCK/min(H,BLOCK) becomes
+// k*T/min(H,T) subhistograms.  M is capped at T (a subhistogram per
+// thread), and the GPU's division of M by three for XCG, which kept
+// the footprint of its locks constant, is not applied.  Fixed degrees
+// use one chunk, like the global GPU sweep.
+
+#include "../library/genhist-host.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <time.h>
+#include <errno.h>
+#include <string.h>
+
+#define HOST_RUNS   10
+
+#ifndef INP_LEN
+#define INP_LEN     50000000
+#endif
+#define Hmax        4000000
+
+/***********************/
+/*** Pretty printing ***/
+/***********************/
+
+#define RESET   "\033[0m"
+#define BOLD    "\033[1m"
+
+template<int num_histos, int num_m_degs>
+void printTextTab( const unsigned long runtimes[3][num_histos][num_m_degs]
+                 , const int histo_sizes[num_histos]
+                 , const int kms[num_m_degs]
+                 , const int RF) {
+    for(int k=0; k<3; k++) {
+        printf("\n\n");
+
+        printf(BOLD "%s, RF=%d\n" RESET,
+               k == 0 ? "HDW" :
+               k == 1 ? "CAS" :
+               "XCG",
+               RF);
+
+        for(int i = 0; i<num_histos; i++) {
+            printf(BOLD "\tH=%d" RESET, histo_sizes[i]);
+        }
+
+        printf("\n");
+
+        for(int j=0; j<num_m_degs; j++) {
+          if (j < num_m_degs-1) {
+              printf(BOLD "M=%d\t" RESET, kms[j]);
+          } else {
+              printf(BOLD "Auto\t" RESET);
+          }
+          for(int i = 0; i<num_histos; i++) {
+              printf("%lu\t", runtimes[k][i][j]);
+          }
+          printf("\n");
+        }
+    }
+}
+
+template<int num_histos, int num_m_degs>
+void printCSV(const char *csv, int k,
+              const unsigned long runtimes[3][num_histos][num_m_degs],
+              const int histo_sizes[num_histos],
+              const int kms[num_m_degs],
+              const char *mstr) {
+
+    FILE* f = fopen(csv, "w");
+
+    if (f == NULL) {
+        fprintf(stderr, "Failed to open %s: %s\n", csv, strerror(errno));
+        return;
+    }
+
+    fprintf(f, "M,");
+    for(int i = 0; i<num_histos; i++) {
+        fprintf(f, "%d", histo_sizes[i]);
+        if (i != num_histos-1) {
+            fprintf(f, ",");
+        } else {
+            fprintf(f, "\n");
+        }
+    }
+
+    for(int j=0; j<num_m_degs; j++) {
+        if (j < num_m_degs-1) {
+            fprintf(f, "%s%d", mstr, kms[j]);
+        } else {
+            fprintf(f, "Auto");
+        }
+        for(int i = 0; i<num_histos; i++) {
+            fprintf(f, ",%lu", runtimes[k][i][j]);
+        }
+        fprintf(f, "\n");
+    }
+
+    fclose(f);
+}
+
+/***************************/
+/*** Histogram operators ***/
+/***************************/
+
+// The operators of histo-kernels.cu.h, with the race factor given at
+// run time: element 'pixel' updates bin (pixel % max(1, H/RF)) * RF.
+
+struct AddI32 : genhist::HistDescriptor<int32_t, int32_t> {
+    int RF;
+    explicit AddI32(int RF = 1) : RF(RF) { }
+
+    inline genhist::indval<BETA> f(const int32_t H, ALPHA pixel) const {
+        genhist::indval<BETA> res;
+        const uint32_t ratio = std::max(1, H/RF);
+        res.index = (((uint32_t)pixel) % ratio) * RF;
+        res.value = pixel;
+        return res;
+    }
+
+    inline void fBatch(const int32_t H, const ALPHA* xs, int n, uint32_t* idx, BETA* vals) const {
+        const genhist::FastDiv ratio(std::max(1, H/RF));
+        for (int i = 0; i < n; i++) {
+            idx[i] = ratio.mod((uint32_t)xs[i]) * RF;
+            vals[i] = xs[i];
+        }
+    }
+
+    inline static BETA ne() { return 0; }
+
+    inline static BETA opScal(BETA v1, BETA v2) {
+        return (uint32_t)v1 + (uint32_t)v2;
+    }
+
+    inline static genhist::AtomicPrim atomicKind() { return genhist::HDW; }
+
+    static const bool simd_add = true;
+};
+
+struct SatAdd24 : genhist::HistDescriptor<int32_t, uint32_t> {
+    int RF;
+    explicit SatAdd24(int RF = 1) : RF(RF) { }
+
+    inline genhist::indval<BETA> f(const int32_t H, ALPHA pixel) const {
+        genhist::indval<BETA> res;
+        const uint32_t ratio = std::max(1, H/RF);
+        res.index = (((uint32_t)pixel) % ratio) * RF;
+        res.value = pixel % 4;
+        return res;
+    }
+
+    inline void fBatch(const int32_t H, const ALPHA* xs, int n, uint32_t* idx, BETA* vals) const {
+        const genhist::FastDiv ratio(std::max(1, H/RF));
+        for (int i = 0; i < n; i++) {
+            idx[i] = ratio.mod((uint32_t)xs[i]) * RF;
+            vals[i] = xs[i] % 4;
+        }
+    }
+
+    inline static BETA ne() { return 0; }
+
+    // 24-bits saturated addition
+    inline static BETA opScal(BETA v1, BETA v2) {
+        const uint32_t SAT_VAL24 = (1 << 24) - 1;
+        return SAT_VAL24 - v1 < v2 ? SAT_VAL24 : v1 + v2;
+    }
+
+    inline static genhist::AtomicPrim atomicKind() { return genhist::CAS; }
+};
+
+struct ArgMaxI64 : genhist::HistDescriptor<int32_t, uint64_t> {
+    int RF;
+    explicit ArgMaxI64(int RF = 1) : RF(RF) { }
+
+    inline static BETA pack64(uint32_t ind, uint32_t val) {
+        return (uint64_t)ind | ((uint64_t)val << 32);
+    }
+
+    inline genhist::indval<BETA> f(const int32_t H, ALPHA pixel) const {
+        genhist::indval<BETA> res;
+        const uint32_t ratio = std::max(1, H/RF);
+        res.index = (((uint32_t)pixel) % ratio) * RF;
+        res.value = pack64((uint32_t)pixel/64, (uint32_t)pixel);
+        return res;
+    }
+
+    inline static BETA ne() { return 0; }
+
+    inline static BETA opScal(BETA v1, BETA v2) {
+        const uint32_t ind1 = (uint32_t)v1, val1 = (uint32_t)(v1 >> 32);
+        const uint32_t ind2 = (uint32_t)v2, val2 = (uint32_t)(v2 >> 32);
+        if (val1 < val2) {
+            return v2;
+        } else if (val1 > val2) {
+            return v1;
+        } else {
+            return pack64(std::min(ind1, ind2), val1);
+        }
+    }
+
+    inline static genhist::AtomicPrim atomicKind() { return genhist::XCG; }
+};
+
+/***********************/
+/*** Various Helpers ***/
+/***********************/
+
+int timeval_subtract(struct timeval *result, struct timeval *t2, struct timeval *t1)
+{
+    unsigned int resolution=1000000;
+    long int diff = (t2->tv_usec + resolution * t2->tv_sec) - (t1->tv_usec + resolution * t1->tv_sec);
+    result->tv_sec = diff / resolution;
+    result->tv_usec = diff % resolution;
+    return (diff<0);
+}
+
+void randomInit(int* data, int size) {
+    for (int i = 0; i < size; ++i)
+        data[i] = rand(); // (float)RAND_MAX;
+}
+
+template<class HP>
+void goldSeqHisto(const HP& desc, const int N, const int H, int* input, typename HP::BETA* histo) {
+    for(int i=0; i<H; i++) {
+        histo[i] = desc.ne();
+    }
+    for(int i=0; i<N; i++) {
+        genhist::indval<typename HP::BETA> iv = desc.f(H, input[i]);
+        if (iv.index < (uint32_t)H) { // like the engines, skip indices beyond H
+            histo[iv.index] = desc.opScal(histo[iv.index], iv.value);
+        }
+    }
+}
+
+// The average runtime in microseconds of the histogram with M
+// subhistograms and 'num_chunks' chunks, or those of the cost model
+// if M is zero, after validating it against 'ref'.
+template<class HP>
+unsigned long hostHistoRunValid(const HP& desc, const int RF, const int H, const int N,
+                                const int M, const int num_chunks,
+                                int* h_input, typename HP::BETA* ref) {
+    genhist::HostGenHist<HP> do_genhist(genhist::host_default, RF, H, N, M, num_chunks, desc);
+    if (M == 0) {
+        printf("Our M: %d, num_chunks: %d, C: %d, for H: %d\n", do_genhist.numSubhistos(),
+               do_genhist.numChunks(), do_genhist.numCooperating(), H);
+    }
+
+    // dry run
+    do_genhist.exec(h_input);
+
+    struct timeval t_start, t_end, t_diff;
+    gettimeofday(&t_start, NULL);
+    for(int q=0; q<HOST_RUNS; q++) {
+        do_genhist.exec(h_input);
+    }
+    gettimeofday(&t_end, NULL);
+    timeval_subtract(&t_diff, &t_end, &t_start);
+    const unsigned long elapsed = t_diff.tv_sec*1e6+t_diff.tv_usec;
+
+    for(int i=0; i<H; i++) {
+        if (do_genhist.result()[i] != ref[i]) {
+            printf("INVALID RESULT for H=%d, M=%d, index %d\n", H, M, i);
+            exit(3);
+        }
+    }
+    return elapsed / HOST_RUNS;
+}
+
+// Time every operator for every histogram size and every degree in
+// 'degs' (whose last entry stands for the cost model).
+template<int num_histos, int num_m_degs>
+void sweep(int* h_input, uint64_t* h_histo, const int RF, const int N,
+           const int histo_sizes[num_histos], const int (*degs)[num_m_degs],
+           unsigned long runtimes[3][num_histos][num_m_degs]) {
+    for(int i=0; i<num_histos; i++) {
+        const int H = histo_sizes[i];
+
+        { // FOR HDW
+            const AddI32 desc(RF);
+            goldSeqHisto(desc, N, H, h_input, (int32_t*)h_histo);
+            for(int j=0; j<num_m_degs; j++) {
+                const int M = j < num_m_degs-1 ? degs[i][j] : 0;
+                runtimes[0][i][j] = hostHistoRunValid(desc, RF, H, N, M, M ? 1 : 0, h_input, (int32_t*)h_histo);
+            }
+        }
+
+        { // FOR CAS
+            const SatAdd24 desc(RF);
+            goldSeqHisto(desc, N, H, h_input, (uint32_t*)h_histo);
+            for(int j=0; j<num_m_degs; j++) {
+                const int M = j < num_m_degs-1 ? degs[i][j] : 0;
+                runtimes[1][i][j] = hostHistoRunValid(desc, RF, H, N, M, M ? 1 : 0, h_input, (uint32_t*)h_histo);
+            }
+        }
+
+        { // FOR XCG
+            const ArgMaxI64 desc(RF);
+            goldSeqHisto(desc, N, H, h_input, h_histo);
+            for(int j=0; j<num_m_degs; j++) {
+                const int M = j < num_m_degs-1 ? degs[i][j] : 0;
+                runtimes[2][i][j] = hostHistoRunValid(desc, RF, H, N, M, M ? 1 : 0, h_input, h_histo);
+            }
+        }
+    }
+}
+
+/****************/
+/*** The meat ***/
+/****************/
+
+void runLocalMemDataset(int* h_input, uint64_t* h_histo, int RF, int N,
+                        const char *hdw_csv, const char *cas_csv, const char *xcg_csv) {
+    const int num_histos = 8;
+    const int num_m_degs = 6;
+    const int histo_sizes[num_histos] = {31, 127, 505, 2041, 6141, 12281, 24569, 49145};
+    const int ks[num_m_degs] = { 0, 1, 3, 6, 9, 33 };
+    const int T = genhist::WorkerPool::defaultPool().numThreads();
+    int subhisto_degs[num_histos][num_m_degs];
+    unsigned long runtimes[3][num_histos][num_m_degs];
+
+    for(int i=0; i<num_histos; i++) {
+        const int min_HT = std::min(histo_sizes[i], T);
+        for(int j=0; j<num_m_degs; j++) {
+            subhisto_degs[i][j] = std::max(1, ks[j]*T/min_HT);
+        }
+    }
+
+    sweep<num_histos,num_m_degs>(h_input, h_histo, RF, N, histo_sizes, subhisto_degs, runtimes);
+
+    printf("Running Histo on the CPU, local sizes: RACE_FACT: %d, threads: %d\n", RF, T);
+
+    printTextTab<num_histos,num_m_degs>(runtimes, histo_sizes, ks, RF);
+
+    if (hdw_csv) {
+        printCSV(hdw_csv, 0, runtimes, histo_sizes, ks, "_");
+    }
+    if (cas_csv) {
+        printCSV(cas_csv, 1, runtimes, histo_sizes, ks, "_");
+    }
+    if (xcg_csv) {
+        printCSV(xcg_csv, 2, runtimes, histo_sizes, ks, "_");
+    }
+}
+
+void runGlobalMemDataset(int* h_input, uint64_t* h_histo, const int RF, const int N,
+                        const char *hdw_csv, const char *cas_csv, const char *xcg_csv) {
+    const int num_histos = 7;
+    const int num_m_degs = 6;
+    const int histo_sizes[num_histos] = { 12281,  24569,  49145
+                                        , 196607, 393215, 786431, 1572863 };
+    const int subhisto_degs[num_m_degs] = { 1, 4, 8, 16, 32, 33 };
+    const int T = genhist::WorkerPool::defaultPool().numThreads();
+    int degs[num_histos][num_m_degs];
+    unsigned long runtimes[3][num_histos][num_m_degs];
+
+    for(int i=0; i<num_histos; i++) {
+        for(int j=0; j<num_m_degs; j++) {
+            degs[i][j] = subhisto_degs[j];
+        }
+    }
+
+    sweep<num_histos,num_m_degs>(h_input, h_histo, RF, N, histo_sizes, degs, runtimes);
+
+    printf("Running Histo on the CPU, global sizes: RACE_FACT: %d, threads: %d, LLCache: %d, L2Fract: %f\n",
+           RF, T, genhist::host_default.LLCache, genhist::host_default.L2Fract);
+
+    printTextTab<num_histos,num_m_degs>(runtimes, histo_sizes, subhisto_degs, RF);
+
+    if (hdw_csv) {
+        printCSV(hdw_csv, 0, runtimes, histo_sizes, subhisto_degs, "=");
+    }
+    if (cas_csv) {
+        printCSV(cas_csv, 1, runtimes, histo_sizes, subhisto_degs, "=");
+    }
+    if (xcg_csv) {
+        printCSV(xcg_csv, 2, runtimes, histo_sizes, subhisto_degs, "=");
+    }
+}
+
+void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s <local|global> RF [hdw.csv cas.csv xcg.csv]\n", prog);
+    exit(1);
+}
+
+/////////////////////////////////////////////////////////
+// Program main
+/////////////////////////////////////////////////////////
+int main(int argc, char **argv) {
+    if (argc != 3 && argc != 6) {
+        usage(argv[0]);
+    }
+
+    int run_local;
+    if (strcmp(argv[1], "local") == 0) {
+        run_local = 1;
+    } else if (strcmp(argv[1], "global") == 0) {
+        run_local = 0;
+    } else {
+        usage(argv[0]);
+    }
+
+    int RF = atoi(argv[2]);
+    if (RF <= 0) {
+        usage(argv[0]);
+    }
+    const char *hdw_csv = NULL;
+    const char *cas_csv = NULL;
+    const char *xcg_csv = NULL;
+
+    if (argc == 6) {
+        hdw_csv = argv[3];
+        cas_csv = argv[4];
+        xcg_csv = argv[5];
+    }
+
+    // set seed for rand()
+    srand(2006);
+
+    // 1. allocate host memory for input and histogram
+    int* h_input = (int*) malloc(sizeof(int) * INP_LEN);
+    uint64_t* h_histo = (uint64_t*) malloc(sizeof(uint64_t) * Hmax);
+
+    // 2. initialize host memory
+    randomInit(h_input, INP_LEN);
+
+    if (run_local) {
+        runLocalMemDataset(h_input, h_histo, RF, INP_LEN,
+                           hdw_csv, cas_csv, xcg_csv);
+    } else {
+        runGlobalMemDataset(h_input, h_histo, RF, INP_LEN,
+                            hdw_csv, cas_csv, xcg_csv);
+    }
+
+    // 3. clean up memory
+    free(h_input);
+    free(h_histo);
+}